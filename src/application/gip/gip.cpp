@@ -116,8 +116,7 @@ static void signal_handler(int signum)
 {
     switch (signum) {
     case SIGHUP:
-        cout << "SIGHUP" << endl;
-        Geo_module::module.instance->terminate_service();
+        Geo_module::module.instance->request_reload();
         break;
     case SIGINT:    // currently not caught
         cout << "SIGINT" << endl;
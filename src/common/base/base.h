@@ -17,9 +17,11 @@
 #include "base_module.h"
 #include "base_options.h"
 #include "base_platform.h"
+#include "base_queue.h"
 #include "base_reference.h"
 #include "base_serialization.h"
 #include "base_stl_util.h"
 #include "base_stl_wrapper.h"
+#include "base_string.h"
 
 #endif
@@ -12,6 +12,8 @@
 #include "base_serialization.h"
 #include "base_options.h"
 #include "base_io.h"
+#include "base_string.h"
+#include "base_queue.h"
 #include <string>
 #include <sstream>
 #ifndef PLATFORM_WIN
@@ -332,16 +334,83 @@ static void test_ring_buffer()
 #endif
 }
 
+static void test_string_slice()
+{
+    std::string str = "foo,bar";
+    String_slice slice(str);
+    size_t idx = slice.find(',');
+    assert(idx == 3);
+    String_slice head = slice.substr(0, idx);
+    String_slice tail = slice.substr(idx + 1);
+    assert(head == "foo" && tail == "bar");
+    assert(tail < head && tail.to_string() == "bar");
+    assert(slice.find('x') == std::string::npos && slice.substr(10).empty());
+}
+
+static void test_cache()
+{
+    Cache<int,int> cache(2);
+    cache.store(1, 10);
+    cache.store(2, 20);
+    int val = 0;
+    assert(cache.get(1, val) && val == 10);
+    cache.store(3, 30);
+    assert(!cache.contains(2) && cache.find_lru() == 10 && cache.find_mru() == 30);
+    cache.store(1, 11);
+    assert(cache.find(1) == 11 && cache.get_size() == 2);
+    assert(cache.remove(3) && !cache.remove(3) && cache.get_size() == 1);
+    Cache<int,int> lfu(2);
+    lfu.set_admission(true);
+    lfu.store(1, 10);
+    lfu.store(2, 20);
+    lfu.find(1);
+    lfu.find(2);
+    lfu.find(2);
+    lfu.store(3, 30);
+    assert(!lfu.contains(3) && lfu.contains(1));
+    for (int i = 0; i < 3; i++)
+        lfu.find(3);
+    lfu.store(3, 30);
+    assert(lfu.contains(3) && !lfu.contains(1));
+}
+
+static void test_queues()
+{
+    Spsc_queue<int> spsc(3);
+    assert(spsc.get_capacity() == 4 && spsc.is_empty() && !spsc.front());
+    for (int i = 0; i < 4; i++)
+        assert(spsc.push(i));
+    assert(!spsc.push(4) && spsc.get_size() == 4 && *spsc.front() == 0);
+    int val = -1;
+    assert(spsc.pop(val) && val == 0 && spsc.push(4));
+    for (int i = 1; i <= 4; i++)
+        assert(spsc.pop(val) && val == i);
+    assert(!spsc.pop(val) && spsc.is_empty());
+    Mpmc_queue<int> mpmc(2);
+    assert(mpmc.is_empty() && mpmc.push(1) && mpmc.push(2) && !mpmc.push(3));
+    assert(mpmc.pop(val) && val == 1 && mpmc.push(3));
+    assert(mpmc.pop(val) && val == 2 && mpmc.pop(val) && val == 3);
+    assert(!mpmc.pop(val) && mpmc.is_empty());
+}
+
 void Base_module::test()
 {
     register_class<Test_class>();
     test_serialization();
     test_arrays();
     test_containers();
+    test_string_slice();
+    test_cache();
+    test_queues();
 
     Reference<> ref;
     Weak_reference<> wref;
     ref = wref;
+    Test_class_ref moved(new Test_class());
+    Test_class_ref target(std::move(moved));
+    assert(!moved && target->get_ref_count() == 1);
+    moved = std::move(target);
+    assert(!target && moved->get_ref_count() == 1);
 
 #ifndef PLATFORM_WIN
     char* argv[7];
@@ -206,7 +206,16 @@ int Configuration::get_parameter(const string& key, int default_value) const
 {
     const Config_param* param = params.get(key);
     const Config_int_param* int_param = dynamic_cast<const Config_int_param*>(param);
-    return int_param ? int_param->get_value() : default_value;
+    if (int_param)
+        return int_param->get_value();
+    // config files store every value as string
+    const Config_string_param* string_param = dynamic_cast<const Config_string_param*>(param);
+    if (!string_param)
+        return default_value;
+    const string& value = string_param->get_value();
+    char* end = 0;
+    long result = strtol(value.c_str(), &end, 10);
+    return end != value.c_str() && *end == '\0' ? (int) result : default_value;
 }
 
 void Configuration::set_parameter(const string& key, const string& value)
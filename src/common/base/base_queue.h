@@ -0,0 +1,92 @@
+//
+//  base_queue.h
+//
+//  Created by Christian Lehner on 18/10/26.
+//  Copyright (c) 2019 Softhub. All rights reserved.
+//
+
+#ifndef BASE_QUEUE_H
+#define BASE_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+
+#define BASE_CACHE_LINE_SIZE 64
+
+namespace SOFTHUB {
+namespace BASE {
+
+//
+// class Spsc_queue
+//
+// A bounded lock free queue for one producing and one consuming thread. The capacity is rounded up
+// to a power of two. Push fails when the queue is full, so the producer decides how to wait.
+//
+
+template <typename T>
+class Spsc_queue {
+
+    T* elements;
+    size_t mask;
+    char pad0[BASE_CACHE_LINE_SIZE];
+    std::atomic<size_t> head;
+    char pad1[BASE_CACHE_LINE_SIZE];
+    std::atomic<size_t> tail;
+    char pad2[BASE_CACHE_LINE_SIZE];
+
+    Spsc_queue(const Spsc_queue&);
+    Spsc_queue& operator=(const Spsc_queue&);
+
+public:
+    Spsc_queue(size_t capacity);
+    ~Spsc_queue() { delete[] elements; }
+
+    bool push(const T& element);
+    bool pop(T& element);
+    const T* front() const;
+    bool is_empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+    size_t get_size() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+    size_t get_capacity() const { return mask + 1; }
+};
+
+//
+// class Mpmc_queue
+//
+// A bounded lock free queue for any number of producers and consumers. Every cell carries a sequence
+// number which tells whether it is ready to be written or read in the current round.
+//
+
+template <typename T>
+class Mpmc_queue {
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T element;
+    };
+
+    Cell* cells;
+    size_t mask;
+    char pad0[BASE_CACHE_LINE_SIZE];
+    std::atomic<size_t> enqueue_pos;
+    char pad1[BASE_CACHE_LINE_SIZE];
+    std::atomic<size_t> dequeue_pos;
+    char pad2[BASE_CACHE_LINE_SIZE];
+
+    Mpmc_queue(const Mpmc_queue&);
+    Mpmc_queue& operator=(const Mpmc_queue&);
+
+public:
+    Mpmc_queue(size_t capacity);
+    ~Mpmc_queue() { delete[] cells; }
+
+    bool push(const T& element);
+    bool pop(T& element);
+    bool is_empty() const;
+    size_t get_capacity() const { return mask + 1; }
+};
+
+}}
+
+#include "base_queue_inline.h"
+
+#endif
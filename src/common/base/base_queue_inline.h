@@ -0,0 +1,132 @@
+//
+//  base_queue_inline.h
+//
+//  Created by Christian Lehner on 18/10/26.
+//  Copyright (c) 2019 Softhub. All rights reserved.
+//
+
+#ifndef BASE_QUEUE_INLINE_H
+#define BASE_QUEUE_INLINE_H
+
+namespace SOFTHUB {
+namespace BASE {
+
+inline size_t queue_capacity(size_t capacity)
+{
+    size_t n = 2;
+    while (n < capacity)
+        n <<= 1;
+    return n;
+}
+
+//
+// class Spsc_queue
+//
+
+template <typename T>
+Spsc_queue<T>::Spsc_queue(size_t capacity) : head(0), tail(0)
+{
+    size_t n = queue_capacity(capacity);
+    elements = new T[n];
+    mask = n - 1;
+}
+
+template <typename T>
+bool Spsc_queue<T>::push(const T& element)
+{
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) > mask)
+        return false;
+    elements[t & mask] = element;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool Spsc_queue<T>::pop(T& element)
+{
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire))
+        return false;
+    element = elements[h & mask];
+    elements[h & mask] = T();
+    head.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+const T* Spsc_queue<T>::front() const
+{
+    size_t h = head.load(std::memory_order_relaxed);
+    return h == tail.load(std::memory_order_acquire) ? 0 : &elements[h & mask];
+}
+
+//
+// class Mpmc_queue
+//
+
+template <typename T>
+Mpmc_queue<T>::Mpmc_queue(size_t capacity) : enqueue_pos(0), dequeue_pos(0)
+{
+    size_t n = queue_capacity(capacity);
+    cells = new Cell[n];
+    mask = n - 1;
+    for (size_t i = 0; i < n; i++)
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+template <typename T>
+bool Mpmc_queue<T>::push(const T& element)
+{
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+        Cell& cell = cells[pos & mask];
+        size_t seq = cell.sequence.load(std::memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t) seq - (ptrdiff_t) pos;
+        if (diff == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell.element = element;
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template <typename T>
+bool Mpmc_queue<T>::pop(T& element)
+{
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+        Cell& cell = cells[pos & mask];
+        size_t seq = cell.sequence.load(std::memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t) seq - (ptrdiff_t) (pos + 1);
+        if (diff == 0) {
+            if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                element = cell.element;
+                cell.element = T();
+                cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template <typename T>
+bool Mpmc_queue<T>::is_empty() const
+{
+    size_t pos = dequeue_pos.load(std::memory_order_acquire);
+    return cells[pos & mask].sequence.load(std::memory_order_acquire) != pos + 1;
+}
+
+}}
+
+#endif
@@ -9,9 +9,16 @@
 #ifndef BASE_REFERENCE_H
 #define BASE_REFERENCE_H
 
+#ifndef FEATURE_BASE_ATOMIC_REF_COUNT
+#define FEATURE_BASE_ATOMIC_REF_COUNT 1
+#endif
+
 #include "base_platform.h"
 #include "base_types.h"
 #include <string>
+#if FEATURE_BASE_ATOMIC_REF_COUNT
+#include <atomic>
+#endif
 
 const class_id_type class_id_nil = 0;
 const class_id_type class_id_array = -1;
@@ -130,6 +137,8 @@ public:
 //
 // Object template class
 //
+// With FEATURE_BASE_ATOMIC_REF_COUNT, objects may be retained and released from several threads.
+//
 
 template <typename I = Serializable>
 class Object : public I {
@@ -143,7 +152,11 @@ class Object : public I {
     int release_internal() const;
 
 protected:
+#if FEATURE_BASE_ATOMIC_REF_COUNT
+    mutable std::atomic<int> ref_count;
+#else
     mutable int ref_count;
+#endif
 #ifdef UNIQUE_ID_SUPPORT
     mutable Object_id unique_id;
 
@@ -190,11 +203,13 @@ public:
     Reference();
     Reference(T* data);
     Reference(const Reference& ref);
+    Reference(Reference&& ref) : data(ref.data) { ref.data = 0; }
     template <typename C>
     explicit Reference(const Reference<C>& ref);
     ~Reference();
 
     const Reference& operator=(const Reference& ref);
+    const Reference& operator=(Reference&& ref);
     const Reference& operator=(T* obj);
     const T* operator->() const { assert(data); return data; }
     T* operator->() { assert(data); return data; }
@@ -64,6 +64,19 @@ const Reference<T>& Reference<T>::operator=(const Reference<T>& ref)
     return *this;
 }
 
+template <typename T>
+const Reference<T>& Reference<T>::operator=(Reference<T>&& ref)
+{
+    if (this != &ref) {
+        T* obj = data;
+        data = ref.data;
+        ref.data = 0;
+        if (obj)
+            obj->release();
+    }
+    return *this;
+}
+
 template <typename T>
 const Reference<T>& Reference<T>::operator=(T* obj)
 {
@@ -153,6 +166,37 @@ Object<T>::~Object()
 {
 }
 
+#if FEATURE_BASE_ATOMIC_REF_COUNT
+
+template <typename T>
+int Object<T>::retain() const
+{
+    return ref_count.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+template <typename T>
+int Object<T>::release() const
+{
+    int count = ref_count.fetch_sub(1, std::memory_order_release) - 1;
+    assert(count >= 0);
+    if (count > 0)
+        return count;
+    // make the writes of other threads that released the object visible to the destructor
+    std::atomic_thread_fence(std::memory_order_acquire);
+    delete this;
+    return 0;
+}
+
+template <typename T>
+int Object<T>::release_internal() const
+{
+    int count = ref_count.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    assert(count >= 0);
+    return count;
+}
+
+#else
+
 template <typename T>
 int Object<T>::retain() const
 {
@@ -176,6 +220,8 @@ int Object<T>::release_internal() const
     return --ref_count;
 }
 
+#endif
+
 template <typename T>
 Serializable* Object<T>::copy() const
 {
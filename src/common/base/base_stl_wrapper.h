@@ -245,38 +245,80 @@ public:
     V& value_at(size_t index);
 };
 
+//
+// class Frequency_sketch
+//
+// Approximate access counts for the admission policy of a Cache. A count-min sketch with four rows
+// of small saturating counters, all counters are halved periodically so that old popularity fades.
+//
+
+class Frequency_sketch {
+
+    std::vector<unsigned char> counters;
+    size_t width;
+    size_t additions;
+
+    size_t index_of(size_t hash, int row) const;
+
+public:
+    Frequency_sketch() : width(0), additions(0) {}
+
+    bool is_enabled() const { return width > 0; }
+    void resize(size_t capacity);
+    void increment(size_t hash);
+    int estimate(size_t hash) const;
+    void clear();
+};
+
 //
 // class Cache
 //
+// An LRU cache. The entries are kept in a list in order of use, least recently used first, and a
+// hash map refers to the list position of each key, so all operations take constant time. With
+// admission enabled, a new key only replaces the least recently used one when the key has been
+// asked for more frequently (TinyLFU).
+//
 
 template <typename K, typename V, typename I = IAny>
 class Cache : public I {
 
 public:
-    typedef BASE::List<K> Keys;
-    typedef BASE::Hash_map<K,V> Map;
+    typedef std::pair<K,V> value_type;
+    typedef BASE::List<value_type> Entries;
+    typedef BASE::Hash_map<K,typename Entries::iterator> Map;
+    typedef typename Entries::iterator iterator;
+    typedef typename Entries::const_iterator const_iterator;
+    typedef typename Entries::size_type size_type;
 
 protected:
     size_t capacity;
-    Keys list;
+    Entries list;
     Map container;
+    mutable Frequency_sketch sketch;
 
     static V null;
 
-public:
-    typedef typename Map::iterator iterator;
-    typedef typename Map::const_iterator const_iterator;
-    typedef typename Map::size_type size_type;
-    typedef typename Map::value_type value_type;
+    size_t hash_of(const K& key) const { return container.hash_function()(key); }
+    void record(const K& key) const;
+    bool admit(const K& key) const;
 
+private:
+    // the map refers to positions in the list, a copy would refer to the list of the original
+    Cache(const Cache&);
+    Cache& operator=(const Cache&);
+
+public:
     Cache(int capacity) : capacity(capacity) {}
 
     size_t get_size() const { return list.size(); }
-    void set_capacity(size_t capacity) { this->capacity = capacity; }
+    void set_capacity(size_t capacity);
     size_t get_capacity() const { return capacity; }
-    const Keys& get_keys() const { return list; }
-    bool is_empty() const { return list.size() == 0; }
+    void set_admission(bool enabled);
+    bool has_admission() const { return sketch.is_enabled(); }
+    bool is_empty() const { return list.empty(); }
     bool is_full() const { return list.size() >= capacity; }
+    const_iterator begin() const { return list.begin(); }
+    const_iterator end() const { return list.end(); }
     void push_back(const value_type& val) { store(val.first, val.second); }
     bool store(const K& key, const V& val);
     bool remove(const K& key);
@@ -284,6 +326,7 @@ public:
     bool contains(const K& key) const { return container.contains(key); }
     const V& find(const K& key) const;
     V& find(const K& key);
+    bool get(const K& key, V& val);
     const V& find_lru() const;
     const V& find_mru() const;
     void touch(const K& key);
@@ -444,107 +444,187 @@ V& Hash_array<K,V>::value_at(size_t index)
 
 template <typename K, typename V> V Hash_array<K,V>::null;
 
+//
+// class Frequency_sketch
+//
+
+inline size_t Frequency_sketch::index_of(size_t hash, int row) const
+{
+    static const unsigned long long seeds[] = {
+        0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL
+    };
+    unsigned long long h = (hash + seeds[row]) * seeds[(row + 1) & 3];
+    return row * width + ((h >> 32) & (width - 1));
+}
+
+inline void Frequency_sketch::resize(size_t capacity)
+{
+    width = 16;
+    while (width < capacity)
+        width <<= 1;
+    counters.assign(4 * width, 0);
+    additions = 0;
+}
+
+inline void Frequency_sketch::increment(size_t hash)
+{
+    for (int row = 0; row < 4; row++) {
+        unsigned char& counter = counters[index_of(hash, row)];
+        if (counter < 15)
+            counter++;
+    }
+    if (++additions < 10 * width)
+        return;
+    for (size_t i = 0, n = counters.size(); i < n; i++)
+        counters[i] >>= 1;
+    additions /= 2;
+}
+
+inline int Frequency_sketch::estimate(size_t hash) const
+{
+    int count = 15;
+    for (int row = 0; row < 4; row++)
+        count = std::min(count, (int) counters[index_of(hash, row)]);
+    return count;
+}
+
+inline void Frequency_sketch::clear()
+{
+    std::fill(counters.begin(), counters.end(), 0);
+    additions = 0;
+}
+
 //
 // class Cache
 //
 
+template <typename K, typename V, typename I>
+void Cache<K,V,I>::record(const K& key) const
+{
+    if (sketch.is_enabled())
+        sketch.increment(hash_of(key));
+}
+
+template <typename K, typename V, typename I>
+bool Cache<K,V,I>::admit(const K& key) const
+{
+    if (!sketch.is_enabled() || list.empty())
+        return true;
+    const K& victim = list.front().first;
+    return sketch.estimate(hash_of(key)) > sketch.estimate(hash_of(victim));
+}
+
+template <typename K, typename V, typename I>
+void Cache<K,V,I>::set_capacity(size_t capacity)
+{
+    this->capacity = capacity;
+    while (list.size() > capacity) {
+        container.remove(list.front().first);
+        list.pop_front();
+    }
+    if (sketch.is_enabled())
+        sketch.resize(capacity);
+}
+
+template <typename K, typename V, typename I>
+void Cache<K,V,I>::set_admission(bool enabled)
+{
+    if (enabled)
+        sketch.resize(capacity);
+    else
+        sketch = Frequency_sketch();
+}
+
 template <typename K, typename V, typename I>
 bool Cache<K,V,I>::store(const K& key, const V& val)
 {
-    bool result = false;
-    const_iterator it = container.find(key);
-    const_iterator tail = container.end();
-    if (it == tail) {
-        size_t n = this->list.size();
-        if (n > 0 && n >= this->capacity) {
-            const K& obj = this->list.front();
-#ifdef _DEBUG
-            bool found =
-#endif
-            container.remove(obj);
-#ifdef _DEBUG
-            if (!found)
-                log_message(ERR, "obj not found in cache");
-#endif
-            this->list.pop_front();
-        }
-        this->list.append(key);
-        container.insert(key, val);
-    } else {
-        result = container.insert(key, val);
-        this->list.remove(key);
-        this->list.append(key);
+    typename Map::iterator it = container.find(key);
+    if (it != container.end()) {
+        it->second->second = val;
+        list.splice(list.end(), list, it->second);
+        return true;
     }
+    size_t n = list.size();
+    if (n > 0 && n >= capacity) {
+        if (!admit(key))
+            return false;
+        container.remove(list.front().first);
+        list.pop_front();
+    }
+    list.push_back(value_type(key, val));
+    container.insert(key, --list.end());
 #if UTIL_DEBUG
-    size_t m = this->list.size();
-    size_t n = container.size();
-    assert(m <= this->capacity && n <= this->capacity);
-    assert(m == n);
+    assert(list.size() == container.size());
 #endif
-    return result;
+    return false;
 }
 
 template <typename K, typename V, typename I>
 bool Cache<K,V,I>::remove(const K& key)
 {
-    size_t n = this->list.size();
-    this->list.remove(key);
-    container.remove(key);
-#if UTIL_DEBUG
-    assert(this->list.size() == container.size());
-#endif
-    return this->list.size() == n - 1;
+    typename Map::iterator it = container.find(key);
+    if (it == container.end())
+        return false;
+    list.erase(it->second);
+    container.erase(it);
+    return true;
 }
 
 template <typename K, typename V, typename I>
 void Cache<K,V,I>::clear()
 {
     container.clear();
-    this->list.clear();
-#if UTIL_DEBUG
-    assert(this->list.size() == 0 && this->size() == 0);
-#endif
+    list.clear();
+    if (sketch.is_enabled())
+        sketch.clear();
 }
 
 template <typename K, typename V, typename I>
 const V& Cache<K,V,I>::find(const K& key) const
 {
+    record(key);
     typename Map::const_iterator it = container.find(key);
-    typename Map::const_iterator tail = container.end();
-    return it == tail ? null : it->second;
+    return it == container.end() ? null : it->second->second;
 }
 
 template <typename K, typename V, typename I>
 V& Cache<K,V,I>::find(const K& key)
 {
+    record(key);
+    typename Map::iterator it = container.find(key);
+    return it == container.end() ? null : it->second->second;
+}
+
+template <typename K, typename V, typename I>
+bool Cache<K,V,I>::get(const K& key, V& val)
+{
+    record(key);
     typename Map::iterator it = container.find(key);
-    typename Map::iterator tail = container.end();
-    return it == tail ? null : it->second;
+    if (it == container.end())
+        return false;
+    list.splice(list.end(), list, it->second);
+    val = it->second->second;
+    return true;
 }
 
 template <typename K, typename V, typename I>
 const V& Cache<K,V,I>::find_lru() const
 {
-    if (this->list.empty())
-        return null;
-    const K& key = this->list.front();
-    return container.get(key);
+    return list.empty() ? null : list.front().second;
 }
 
 template <typename K, typename V, typename I>
 const V& Cache<K,V,I>::find_mru() const
 {
-    if (this->list.empty())
-        return null;
-    const K& key = this->list.back();
-    return container.get(key);
+    return list.empty() ? null : list.back().second;
 }
 
 template <typename K, typename V, typename I>
 void Cache<K,V,I>::touch(const K& key)
 {
-    this->list.remove(key);
-    this->list.append(key);
+    typename Map::iterator it = container.find(key);
+    if (it != container.end())
+        list.splice(list.end(), list, it->second);
 }
 
 template <typename K, typename V, typename I> V Cache<K,V,I>::null;
@@ -0,0 +1,107 @@
+//
+//  base_string.h
+//
+//  Created by Softhub.
+//  Copyright (c) 2019 Softhub. All rights reserved.
+//
+
+#ifndef BASE_STRING_H
+#define BASE_STRING_H
+
+#include "base_stl_wrapper.h"
+#include <string>
+#include <ostream>
+#include <string.h>
+
+namespace SOFTHUB {
+namespace BASE {
+
+//
+// class String_slice
+//
+// A non owning view of a character sequence. The referenced characters must outlive the slice.
+//
+
+class String_slice {
+
+    const char* ptr;
+    size_t len;
+
+public:
+    String_slice() : ptr(""), len(0) {}
+    String_slice(const char* s) : ptr(s), len(strlen(s)) {}
+    String_slice(const char* s, size_t len) : ptr(s), len(len) {}
+    String_slice(const std::string& s) : ptr(s.data()), len(s.length()) {}
+
+    const char* data() const { return ptr; }
+    const char* begin() const { return ptr; }
+    const char* end() const { return ptr + len; }
+    size_t length() const { return len; }
+    bool empty() const { return len == 0; }
+    char operator[](size_t idx) const { return ptr[idx]; }
+    String_slice substr(size_t pos, size_t n = std::string::npos) const;
+    size_t find(char c, size_t pos = 0) const;
+    int compare(const String_slice& other) const;
+    bool equals_ignore_case(const String_slice& other) const;
+    bool operator==(const String_slice& other) const { return len == other.len && memcmp(ptr, other.ptr, len) == 0; }
+    bool operator!=(const String_slice& other) const { return !(*this == other); }
+    bool operator<(const String_slice& other) const { return compare(other) < 0; }
+    std::string to_string() const { return std::string(ptr, len); }
+    size_t hash() const;
+};
+
+typedef BASE::Vector<String_slice> String_slices;
+
+inline String_slice String_slice::substr(size_t pos, size_t n) const
+{
+    if (pos > len)
+        pos = len;
+    if (n > len - pos)
+        n = len - pos;
+    return String_slice(ptr + pos, n);
+}
+
+inline size_t String_slice::find(char c, size_t pos) const
+{
+    if (pos >= len)
+        return std::string::npos;
+    const void* p = memchr(ptr + pos, c, len - pos);
+    return p ? (const char*) p - ptr : std::string::npos;
+}
+
+inline int String_slice::compare(const String_slice& other) const
+{
+    size_t n = len < other.len ? len : other.len;
+    int result = memcmp(ptr, other.ptr, n);
+    if (result)
+        return result;
+    return len < other.len ? -1 : len > other.len ? 1 : 0;
+}
+
+inline bool String_slice::equals_ignore_case(const String_slice& other) const
+{
+    if (len != other.len)
+        return false;
+    for (size_t i = 0; i < len; i++) {
+        if (tolower((unsigned char) ptr[i]) != tolower((unsigned char) other.ptr[i]))
+            return false;
+    }
+    return true;
+}
+
+inline size_t String_slice::hash() const
+{
+    size_t h = 0;
+    for (size_t i = 0; i < len; i++)
+        h = h * 31 + (unsigned char) ptr[i];
+    return h;
+}
+
+inline std::ostream& operator<<(std::ostream& stream, const String_slice& slice)
+{
+    return stream.write(slice.data(), slice.length());
+}
+
+}}
+
+#endif
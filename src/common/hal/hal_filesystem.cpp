@@ -27,6 +27,7 @@
 #else
 #include <errno.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #define O_RAW 0
 #endif
 #ifdef PLATFORM_MAC
@@ -678,6 +679,45 @@ int File_info::is_link() const
     return S_ISLNK(st.st_mode) ? 0 : 1;
 }
 
+//
+// class Mapped_file
+//
+
+bool Mapped_file::map(const string& filepath)
+{
+    unmap();
+#ifdef PLATFORM_WIN
+    assert(!"TODO");
+    return false;
+#else
+    int fd = ::open(filepath.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+    void* addr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+        return false;
+    data = (const byte*) addr;
+    size = st.st_size;
+    return true;
+#endif
+}
+
+void Mapped_file::unmap()
+{
+#ifndef PLATFORM_WIN
+    if (data)
+        munmap((void*) data, size);
+#endif
+    data = 0;
+    size = 0;
+}
+
 //
 // class File_system
 //
@@ -123,6 +123,32 @@ public:
     int is_link() const;
 };
 
+//
+// class Mapped_file
+//
+// Maps a file read-only into memory. The mapping is shared, so the pages are held in the page cache
+// only once for all processes mapping the same file.
+//
+
+class Mapped_file {
+
+    const byte* data;
+    size_t size;
+
+    Mapped_file(const Mapped_file&);
+    Mapped_file& operator=(const Mapped_file&);
+
+public:
+    Mapped_file() : data(0), size(0) {}
+    ~Mapped_file() { unmap(); }
+
+    const byte* get_data() const { return data; }
+    size_t get_size() const { return size; }
+    bool is_mapped() const { return data != 0; }
+    bool map(const std::string& filepath);
+    void unmap();
+};
+
 //
 // class Volume_info
 //
@@ -26,13 +26,13 @@ void* Thread_base::invoke(void* arg)
     return 0;
 }
 
-Thread_base::Thread_base() : stopped(true)
+Thread_base::Thread_base() : stopped(true), signaled(false)
 {
     int err = pthread_create(&posix_thread, 0, &Thread::invoke, this);
     assert(!err);
 }
 
-Thread_base::Thread_base(const pthread_t& pthread) : posix_thread(pthread), stopped(false)
+Thread_base::Thread_base(const pthread_t& pthread) : posix_thread(pthread), stopped(false), signaled(true)
 {
 }
 
@@ -42,9 +42,11 @@ Thread_base::~Thread_base()
 
 void Thread_base::run_internal()
 {
-    if (stopped) {
+    {
+        // test and wait under the lock, otherwise a start or stop right before the wait gets lost
         Lock::Block lock(mutex);
-        condition.wait(mutex);
+        while (!signaled)
+            condition.wait(mutex);
     }
     if (!stopped)
         run();
@@ -52,15 +54,17 @@ void Thread_base::run_internal()
 
 void Thread_base::start()
 {
-//  Lock::Block lock(mutex);
+    Lock::Block lock(mutex);
     stopped = false;
+    signaled = true;
     condition.signal();
 }
 
 void Thread_base::stop()
 {
-//  Lock::Block lock(mutex);
+    Lock::Block lock(mutex);
     stopped = true;
+    signaled = true;
     condition.signal();
 }
 
@@ -25,6 +25,7 @@ class Thread_base {
 #endif
 
     bool stopped;
+    bool signaled;
 
     void run_internal();
 
@@ -19,6 +19,7 @@ class Pool_thread : public Thread_base {
     Thread_pool* pool;
     Runnable_ref target;
 
+    bool wait_for_target(Runnable_ref& job);
     void run();
 
 public:
@@ -32,7 +33,7 @@ public:
 
 void Pool_thread::stop()
 {
-//  Lock::Block lock(mutex);
+    Lock::Block lock(mutex);
     Thread_base::stop();
     target = 0;
     condition.signal();
@@ -40,27 +41,37 @@ void Pool_thread::stop()
 
 void Pool_thread::run(Runnable* target)
 {
-//  Lock::Block lock(mutex);
+    Lock::Block lock(mutex);
     assert(!this->target);
     this->target = target;
     condition.signal();
 }
 
-void Pool_thread::run()
+bool Pool_thread::wait_for_target(Runnable_ref& job)
 {
+    // the pool calls run(target) holding its own lock, so the pool state is not touched in here
     Lock::Block lock(mutex);
+    while (!target && !is_stopped())
+        condition.wait(mutex);
+    job = target;
+    return !is_stopped();
+}
+
+void Pool_thread::run()
+{
     while (!is_stopped()) {
+        Runnable_ref job;
         pool->inc_state(pool->num_waiting_threads);
-        condition.wait(mutex);
+        bool keep_on = wait_for_target(job);
         pool->dec_state(pool->num_waiting_threads);
-        if (target) {
+        if (keep_on && job) {
 #if _DEBUG_PERF >= 10
             Timing timing;
             timing.begin();
 #endif
             pool->inc_state(pool->num_active_threads);
-            pool->execute(target);
-            target = 0;
+            pool->execute(job);
+            LOCKED(mutex, target = 0);
             pool->dec_state(pool->num_active_threads);
 #if _DEBUG_PERF >= 10
             long msec = timing.end();
@@ -13,7 +13,7 @@ namespace HAL {
 // class Thread_base, Windows
 //
 
-Thread_base::Thread_base() : evt(0), stopped(false)
+Thread_base::Thread_base() : evt(0), stopped(false), signaled(true)
 {
     LPTHREAD_START_ROUTINE proc = (LPTHREAD_START_ROUTINE) &Thread::invoke;
     LPVOID parameter = this;
@@ -21,7 +21,7 @@ Thread_base::Thread_base() : evt(0), stopped(false)
 }
 
 Thread_base::Thread_base(HANDLE handle, DWORD id)
-  : handle(handle), evt(0), id(id), stopped(false)
+  : handle(handle), evt(0), id(id), stopped(false), signaled(true)
 {
 }
 
@@ -20,6 +20,7 @@
 #include "net_mail.h"
 #include "net_module.h"
 #include "net_observer.h"
+#include "net_reactor.h"
 #include "net_server.h"
 #include "net_socket.h"
 #include "net_url.h"
@@ -29,24 +29,31 @@ namespace SOFTHUB {
 namespace NET {
 
 //
-// class Address
+// class Numeric_address
 //
 
-const Address_const_ref Address::loopback_address = Address_ip4::create_loopback_address(0);
-const Address_const_ref Address::any_address = new Address_ip4(0);
-
-Address* Address::create(int port)
+bool Numeric_address::parse(const String_slice& s, Numeric_address& address)
 {
-    return new Address_ip4(port);
+    // inet_pton needs a terminated string, the literal is copied to the stack
+    char buf[INET6_ADDRSTRLEN];
+    size_t len = s.length();
+    if (len == 0 || len >= sizeof(buf))
+        return false;
+    int family = s.find(':') != string::npos ? AF_INET6 : AF_INET;
+    if (family == AF_INET && (s[0] < '0' || s[0] > '9'))
+        return false;
+    memcpy(buf, s.data(), len);
+    buf[len] = '\0';
+    if (::inet_pton(family, buf, &address.u) != 1)
+        return false;
+    address.family = family;
+    return true;
 }
 
-Address* Address::create(const string& ip, int port)
-{
-    return ip.find('.') ? new Address_ip4(ip.c_str(), port) : 0;
-}
-
-Address* Address::create_from_dns_name(const string& host, int port)
+bool Numeric_address::resolve(const string& host, Numeric_address& address)
 {
+    if (parse(host, address))
+        return true;
     int status;
     struct addrinfo hints;
     struct addrinfo* servinfo;
@@ -54,15 +61,16 @@ Address* Address::create_from_dns_name(const string& host, int port)
     hints.ai_family = AF_UNSPEC;        // don't care IPv4 or IPv6
     hints.ai_socktype = SOCK_STREAM;    // TCP stream sockets
     hints.ai_flags = AI_PASSIVE;        // fill in my IP for me
-    Address* address = 0;
+    bool found = false;
     if ((status = getaddrinfo(host.c_str(), 0, &hints, &servinfo)) == 0) {
         if (servinfo->ai_family == AF_INET) {
-            struct sockaddr_in* ipv4 = (struct sockaddr_in*) servinfo->ai_addr;
-            address = new Address_ip4(ipv4->sin_addr, port);
+            address.family = AF_INET;
+            address.u.ip4 = ((struct sockaddr_in*) servinfo->ai_addr)->sin_addr;
+            found = true;
         } else if (servinfo->ai_family == AF_INET6) {
-            struct sockaddr_in6* ipv6 = (struct sockaddr_in6*) servinfo->ai_addr;
-            // TODO: IP6
-//          address = new Address_ip6(ipv6->sin6_addr, port);
+            address.family = AF_INET6;
+            address.u.ip6 = ((struct sockaddr_in6*) servinfo->ai_addr)->sin6_addr;
+            found = true;
         }
         freeaddrinfo(servinfo);
     } else {
@@ -70,7 +78,44 @@ Address* Address::create_from_dns_name(const string& host, int port)
         stream << "getaddrinfo error: " << gai_strerror(status) << " for " << host << endl;
         log_message(INFO, stream.str());
     }
-    return address;
+    return found;
+}
+
+Address* Numeric_address::create_address(int port) const
+{
+    // TODO: IP6
+    return family == AF_INET ? new Address_ip4(u.ip4, port) : 0;
+}
+
+string Numeric_address::to_string() const
+{
+    char buf[INET6_ADDRSTRLEN];
+    if (family == AF_UNSPEC || !::inet_ntop(family, &u, buf, sizeof(buf)))
+        return "";
+    return buf;
+}
+
+//
+// class Address
+//
+
+const Address_const_ref Address::loopback_address = Address_ip4::create_loopback_address(0);
+const Address_const_ref Address::any_address = new Address_ip4(0);
+
+Address* Address::create(int port)
+{
+    return new Address_ip4(port);
+}
+
+Address* Address::create(const string& ip, int port)
+{
+    return ip.find('.') ? new Address_ip4(ip.c_str(), port) : 0;
+}
+
+Address* Address::create_from_dns_name(const string& host, int port)
+{
+    Numeric_address address;
+    return Numeric_address::resolve(host, address) ? address.create_address(port) : 0;
 }
 
 Address* Address::create(struct sockaddr& addr)
@@ -15,6 +15,7 @@
 #include <string>
 #ifdef PLATFORM_WIN
 #include <winsock2.h>
+#include <ws2tcpip.h>
 typedef in_addr in_addr_t;
 #else
 #include <sys/socket.h>
@@ -32,6 +33,38 @@ FORWARD_CLASS(Address);
 
 typedef BASE::Vector<Address_const_ref> Addresses;
 
+//
+// class Numeric_address
+//
+// An IPv4 or IPv6 address by value. Numeric literals are parsed without a name lookup or allocation,
+// only resolve falls back to DNS for host names.
+//
+
+class Numeric_address {
+
+    int family;
+    union {
+        struct in_addr ip4;
+        struct in6_addr ip6;
+    } u;
+
+public:
+    Numeric_address() : family(AF_UNSPEC) { ::memset(&u, 0, sizeof(u)); }
+    Numeric_address(const struct in_addr& addr) : family(AF_INET) { ::memset(&u, 0, sizeof(u)); u.ip4 = addr; }
+
+    static bool parse(const BASE::String_slice& s, Numeric_address& address);
+    static bool resolve(const std::string& host, Numeric_address& address);
+
+    int get_family() const { return family; }
+    bool is_ip4() const { return family == AF_INET; }
+    bool is_ip6() const { return family == AF_INET6; }
+    unsigned get_ip4_number() const { return ntohl(u.ip4.s_addr); }
+    const struct in_addr& get_in_addr() const { return u.ip4; }
+    const struct in6_addr& get_in6_addr() const { return u.ip6; }
+    Address* create_address(int port) const;
+    std::string to_string() const;
+};
+
 //
 // class Address
 //
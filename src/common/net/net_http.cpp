@@ -581,6 +581,52 @@ void Http_header::parse_header_attribute(const string& line)
         stream >> auth_type >> authorization;
         set_auth_type(auth_type);
         set_authorization(authorization);
+    } else if (attr == "connection:") {
+        string connection;
+        getline(stream, connection);
+        Strings::trim(connection);
+        Strings::to_lower(connection);
+        set_connection(connection);
+    }
+}
+
+static String_slice first_word(const String_slice& value, size_t pos = 0)
+{
+    while (pos < value.length() && isspace((unsigned char) value[pos]))
+        pos++;
+    size_t end = pos;
+    while (end < value.length() && !isspace((unsigned char) value[end]))
+        end++;
+    return value.substr(pos, end - pos);
+}
+
+void Http_header::set_attribute(const String_slice& name, const String_slice& value)
+{
+    // the same attributes as parse_header_attribute, taken from the slices of a parsed request
+    if (name.equals_ignore_case("content-encoding")) {
+        set_content_encoding(value.to_string());
+    } else if (name.equals_ignore_case("content-language")) {
+        set_content_language(value.to_string());
+    } else if (name.equals_ignore_case("content-type")) {
+        set_content_type(first_word(value).to_string());
+    } else if (name.equals_ignore_case("content-length")) {
+        set_content_length(atoi(first_word(value).to_string().c_str()));
+    } else if (name.equals_ignore_case("host")) {
+        set_host(first_word(value).to_string());
+    } else if (name.equals_ignore_case("accept")) {
+        set_accept(first_word(value).to_string());
+    } else if (name.equals_ignore_case("accept-language")) {
+        set_language(first_word(value).to_string());
+    } else if (name.equals_ignore_case("user-agent")) {
+        set_user_agent(value.to_string());
+    } else if (name.equals_ignore_case("authorization")) {
+        const String_slice& auth_type = first_word(value);
+        set_auth_type(auth_type.to_string());
+        set_authorization(first_word(value, auth_type.end() - value.begin()).to_string());
+    } else if (name.equals_ignore_case("connection")) {
+        string connection = value.to_string();
+        Strings::to_lower(connection);
+        set_connection(connection);
     }
 }
 
@@ -608,31 +654,13 @@ Http_request_header::Http_request_header(Http_request_method method) : method(me
 {
 }
 
-Http_request_header* Http_request_header::parse_header(char* buf, int bufsize, int& bytes_remaining)
+void Http_request_header::assign(const Http_request_parser& parser)
 {
-    // TODO: this only works if header fits into max_buf_size byte buffer
-    Http_request_header* header = 0;
-    int count = 0;
-    string line;
-    string text(buf, bufsize);
-    stringstream line_stream(text);
-    if (getline(line_stream, line)) {
-        count += (int) line.length() + 1;
-        Strings::trim(line);
-        if (line.empty())
-            return 0;
-        header = new Http_request_header();
-        stringstream stream(line);
-        string method_name, path, version;
-        stream >> method_name >> path >> version;
-        Http_request_method method = method_from_string(method_name);
-        header->set_method(method);
-        header->set_path(path);
-        header->set_version(version);
-        count += header->parse_header_attributes(line_stream);
-    }
-    bytes_remaining = bufsize - count;
-    return header;
+    set_method(method_from_string(parser.get_method().to_string()));
+    set_path(parser.get_target().to_string());
+    set_version(parser.get_version().to_string());
+    for (size_t i = 0, n = parser.get_field_count(); i < n; i++)
+        set_attribute(parser.get_field_name(i), parser.get_field_value(i));
 }
 
 void Http_request_header::add_custom_parameter(const string& name, const string& value)
@@ -660,6 +688,131 @@ Http_request_method Http_request_header::method_from_string(const string& mid)
     throw Exception(stream.str());
 }
 
+//
+// class Http_request_parser
+//
+
+Http_request_parser::Http_request_parser(size_t max_header_size, size_t max_body_size) :
+    max_header_size(max_header_size), max_body_size(max_body_size)
+{
+    reset();
+}
+
+void Http_request_parser::reset()
+{
+    Span empty = { 0, 0 };
+    data = "";
+    state = parsing_request_line;
+    pos = 0;
+    body_pos = 0;
+    content_length = 0;
+    method = target = version = empty;
+    fields.clear();
+}
+
+Http_request_parser::State Http_request_parser::parse(const char* data, size_t len)
+{
+    this->data = data;
+    while (state == parsing_request_line || state == parsing_header) {
+        const char* eol = pos < len ? (const char*) memchr(data + pos, '\n', len - pos) : 0;
+        size_t next = eol ? eol - data + 1 : len;
+        if (next > max_header_size) {
+            state = parse_failed;
+            break;
+        }
+        // an incomplete line is parsed again once the rest has arrived
+        if (!eol)
+            break;
+        size_t end = eol - data;
+        if (end > pos && data[end - 1] == '\r')
+            end--;
+        parse_line(pos, end, next);
+        pos = next;
+    }
+    if (state == parsing_body && len - body_pos >= content_length)
+        state = parsed;
+    return state;
+}
+
+void Http_request_parser::parse_line(size_t begin, size_t end, size_t next)
+{
+    if (state == parsing_request_line) {
+        // empty lines in front of a request are ignored
+        if (begin < end)
+            state = parse_request_line(begin, end) ? parsing_header : parse_failed;
+    } else if (begin < end) {
+        if (!parse_field(begin, end))
+            state = parse_failed;
+    } else if (!parse_content_length()) {
+        state = parse_failed;
+    } else {
+        body_pos = next;
+        state = content_length > 0 ? parsing_body : parsed;
+    }
+}
+
+bool Http_request_parser::parse_request_line(size_t begin, size_t end)
+{
+    const char* p = data + begin;
+    const char* e = data + end;
+    const char* sp1 = (const char*) memchr(p, ' ', e - p);
+    if (!sp1 || sp1 == p)
+        return false;
+    const char* q = sp1 + 1;
+    const char* sp2 = (const char*) memchr(q, ' ', e - q);
+    const char* target_end = sp2 ? sp2 : e;
+    if (target_end == q)
+        return false;
+    method.pos = begin;
+    method.len = sp1 - p;
+    target.pos = q - data;
+    target.len = target_end - q;
+    version.pos = sp2 ? sp2 + 1 - data : end;
+    version.len = sp2 ? e - sp2 - 1 : 0;
+    return true;
+}
+
+bool Http_request_parser::parse_field(size_t begin, size_t end)
+{
+    const char* p = data + begin;
+    const char* colon = (const char*) memchr(p, ':', end - begin);
+    if (!colon || colon == p)
+        return false;
+    size_t value_pos = colon - data + 1;
+    while (value_pos < end && (data[value_pos] == ' ' || data[value_pos] == '\t'))
+        value_pos++;
+    size_t value_end = end;
+    while (value_end > value_pos && (data[value_end - 1] == ' ' || data[value_end - 1] == '\t'))
+        value_end--;
+    Field field = { { begin, (size_t) (colon - p) }, { value_pos, value_end - value_pos } };
+    fields.append(field);
+    return true;
+}
+
+bool Http_request_parser::parse_content_length()
+{
+    const String_slice& value = find_field("content-length");
+    content_length = 0;
+    for (size_t i = 0; i < value.length(); i++) {
+        if (value[i] < '0' || value[i] > '9')
+            return false;
+        content_length = content_length * 10 + value[i] - '0';
+        if (content_length > max_body_size)
+            return false;
+    }
+    return true;
+}
+
+String_slice Http_request_parser::find_field(const String_slice& name) const
+{
+    for (size_t i = 0, n = fields.size(); i < n; i++) {
+        const String_slice& field_name = slice(fields[i].name);
+        if (field_name.equals_ignore_case(name))
+            return slice(fields[i].value);
+    }
+    return String_slice();
+}
+
 //
 // class Http_response_header
 //
@@ -706,8 +859,8 @@ Http_cache::Http_cache() : HTTP_cache_base(default_cache_size), tmp_dir(default_
 
 void Http_cache::clear()
 {
-    const_iterator it = container.begin();
-    const_iterator tail = container.end();
+    const_iterator it = begin();
+    const_iterator tail = end();
     while (it != tail) {
         const HTTP_cache_base::value_type& value = *it++;
         Http_cache_element_ref element = value.second;
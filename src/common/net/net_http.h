@@ -23,6 +23,7 @@ FORWARD_CLASS(Http_response);
 FORWARD_CLASS(Http_header);
 FORWARD_CLASS(Http_request_header);
 FORWARD_CLASS(Http_response_header);
+FORWARD_CLASS(Http_request_parser);
 FORWARD_CLASS(Http_cache);
 FORWARD_CLASS(Http_cache_element);
 
@@ -35,6 +36,12 @@ typedef enum {
     patch_method
 } Http_request_method;
 
+typedef enum {
+    identity_coding = 0,
+    gzip_coding,
+    deflate_coding
+} Http_content_coding;
+
 typedef BASE::Hash_map<std::string,std::string> HTTP_custom_parameters;
 
 //
@@ -216,9 +223,11 @@ class Http_header : public BASE::Object<> {
     std::string user_agent;
     std::string auth_type;
     std::string authorization;
+    std::string connection;
 
 protected:
     void parse_header_attribute(const std::string& line);
+    void set_attribute(const BASE::String_slice& name, const BASE::String_slice& value);
     time_t parse_date(const std::string& date);
     int parse_header_attributes(std::stringstream& line_stream);
 
@@ -255,6 +264,8 @@ public:
     const std::string& get_auth_type() const { return auth_type; }
     void set_authorization(const std::string& authorization) { this->authorization = authorization; }
     const std::string& get_authorization() const { return authorization; }
+    void set_connection(const std::string& connection) { this->connection = connection; }
+    const std::string& get_connection() const { return connection; }
 
     bool parse_content_type(std::string& type, std::string& encoding) const;
     bool parse_language(std::string& lang, std::string& region) const;
@@ -287,8 +298,75 @@ public:
     const HTTP_custom_parameters& get_custom_parameters() const;
     const std::string& find_custom_parameter(const std::string& name) const;
 
+    void assign(const Http_request_parser& parser);
+
     static Http_request_method method_from_string(const std::string& mid);
-    static Http_request_header* parse_header(char* buf, int bufsize, int& bytes_remaining);
+};
+
+//
+// class Http_request_parser
+//
+// Parses a request from a buffer which grows as data arrives, each call of parse continues where the
+// previous one stopped. The request line and the header fields are kept as offsets into the buffer,
+// the slices returned refer to the buffer passed to the last call of parse. A header longer than
+// max_header_size or a body longer than max_body_size fails the request.
+//
+
+class Http_request_parser {
+
+public:
+    enum State {
+        parsing_request_line,
+        parsing_header,
+        parsing_body,
+        parsed,
+        parse_failed
+    };
+
+private:
+    struct Span {
+        size_t pos;
+        size_t len;
+    };
+
+    struct Field {
+        Span name;
+        Span value;
+    };
+
+    const char* data;
+    State state;
+    size_t pos;
+    size_t body_pos;
+    size_t content_length;
+    size_t max_header_size;
+    size_t max_body_size;
+    Span method;
+    Span target;
+    Span version;
+    BASE::Vector<Field> fields;
+
+    void parse_line(size_t begin, size_t end, size_t next);
+    bool parse_request_line(size_t begin, size_t end);
+    bool parse_field(size_t begin, size_t end);
+    bool parse_content_length();
+    BASE::String_slice slice(const Span& span) const { return BASE::String_slice(data + span.pos, span.len); }
+
+public:
+    Http_request_parser(size_t max_header_size, size_t max_body_size);
+
+    State parse(const char* data, size_t len);
+    void reset();
+    State get_state() const { return state; }
+    size_t get_size() const { return body_pos + content_length; }
+    BASE::String_slice get_method() const { return slice(method); }
+    BASE::String_slice get_target() const { return slice(target); }
+    BASE::String_slice get_version() const { return slice(version); }
+    size_t get_field_count() const { return fields.size(); }
+    BASE::String_slice get_field_name(size_t idx) const { return slice(fields[idx].name); }
+    BASE::String_slice get_field_value(size_t idx) const { return slice(fields[idx].value); }
+    BASE::String_slice find_field(const BASE::String_slice& name) const;
+    BASE::String_slice get_body() const { return BASE::String_slice(data + body_pos, content_length); }
 };
 
 //
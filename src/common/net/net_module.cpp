@@ -168,6 +168,24 @@ static void test_addresses()
     assert(!a8->is_private());
 }
 
+static void test_numeric_addresses()
+{
+    Numeric_address a1;
+    assert(Numeric_address::parse("91.64.54.207", a1) && a1.is_ip4());
+    assert(a1.get_ip4_number() == 0x5b4036cf);
+    assert(a1.to_string() == "91.64.54.207");
+    Numeric_address a2;
+    assert(Numeric_address::parse(String_slice("10.0.0.1 - -", 8), a2) && a2.get_ip4_number() == 0x0a000001);
+    Numeric_address a3;
+    assert(Numeric_address::parse("2001:db8::1", a3) && a3.is_ip6());
+    assert(a3.to_string() == "2001:db8::1");
+    Numeric_address a4;
+    assert(!Numeric_address::parse("softhub.com", a4) && !Numeric_address::parse("1.2.3.256", a4));
+    assert(!Numeric_address::parse("", a4) && !Numeric_address::parse("1.2.3", a4));
+    Address_const_ref a5 = a1.create_address(1963);
+    assert(a5 && a5->to_string(false) == "91.64.54.207" && a5->get_port() == 1963);
+}
+
 static void test_urls()
 {
     string s = "a;92fejn nas9+e=-9o";
@@ -285,6 +303,183 @@ static void test_ssl_connection(Http_factory* factory)
     cout << "ssl access on port 8081" << endl;
 }
 
+#if FEATURE_NET_EPOLL
+class Test_handler : public Reactor_handler {
+
+public:
+    Test_handler() : Reactor_handler(new Socket()) {}
+
+    void on_readable(Reactor* reactor) {}
+};
+
+static void test_timer_wheel()
+{
+    Timer_wheel wheel(4, 10);
+    wheel.reset(0);
+    Reactor_handler_ref h1(new Test_handler());
+    Reactor_handler_ref h2(new Test_handler());
+    Reactor_handler_ref h3(new Test_handler());
+    wheel.schedule(h1, 10);
+    wheel.schedule(h2, 55);
+    wheel.schedule(h3, 30);
+    assert(wheel.get_size() == 3);
+    wheel.cancel(h3);
+    assert(wheel.get_size() == 2 && !h3->has_timer());
+    Vector<Reactor_handler_ref> expired;
+    wheel.advance(9, expired);
+    assert(expired.empty());
+    wheel.advance(10, expired);
+    assert(expired.size() == 1 && expired[0] == h1);
+    expired.clear();
+    wheel.advance(50, expired);
+    assert(expired.empty() && h2->has_timer());
+    wheel.advance(60, expired);
+    assert(expired.size() == 1 && expired[0] == h2 && wheel.empty());
+}
+
+#endif
+
+static size_t test_request_size(const string& request)
+{
+    Http_request_parser parser(1024, 16);
+    return parser.parse(request.data(), request.length()) == Http_request_parser::parsed ? parser.get_size() : 0;
+}
+
+static bool test_persistent(const string& request)
+{
+    Http_request_parser parser(1024, 0);
+    if (parser.parse(request.data(), request.length()) != Http_request_parser::parsed)
+        return false;
+    Http_request_header_ref header(new Http_request_header());
+    header->assign(parser);
+    return Http_server::is_persistent(header);
+}
+
+static void test_http_requests()
+{
+    assert(test_request_size("GET / HTTP/1.1\r\nHost: a") == 0);
+    assert(test_request_size("GET / HTTP/1.1\r\nHost: a\r\n\r\n") == 27);
+    assert(test_request_size("POST / HTTP/1.1\nContent-Length: 3\n\nab") == 0);
+    assert(test_request_size("POST / HTTP/1.1\nContent-Length: 3\n\nabc") == 38);
+    const string pipelined = "GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\nGET /c";
+    size_t size = test_request_size(pipelined);
+    assert(size == 19 && test_persistent(pipelined.substr(0, size)));
+    size_t next = test_request_size(pipelined.substr(size));
+    assert(next == 43 && test_persistent(pipelined.substr(size, next)));
+    assert(test_request_size(pipelined.substr(size + next)) == 0);
+    assert(!test_persistent("GET / HTTP/1.1\r\nConnection: close\r\n\r\n"));
+    assert(!test_persistent("GET / HTTP/1.0\r\n\r\n"));
+    assert(Http_server::negotiate_coding("") == identity_coding);
+    assert(Http_server::negotiate_coding("gzip, deflate, br") == gzip_coding);
+    assert(Http_server::negotiate_coding("gzip;q=0.5, Deflate") == deflate_coding);
+    assert(Http_server::negotiate_coding("gzip;q=0, *") == deflate_coding);
+    assert(Http_server::negotiate_coding("br, identity") == identity_coding);
+}
+
+static void test_http_parser()
+{
+    // the request arrives in pieces, the buffer moves as it grows
+    const string request = "POST /gip?cmd=data HTTP/1.1\r\nHost: a\r\nAccept-Language:  de \r\ncontent-length: 5\r\n\r\nx=1\r\nGET";
+    Http_request_parser parser(128, 16);
+    string input;
+    Http_request_parser::State state = Http_request_parser::parsing_request_line;
+    for (size_t i = 0; i < request.length() && state != Http_request_parser::parsed; i++) {
+        input += request[i];
+        string moved = input;
+        state = parser.parse(moved.data(), moved.length());
+        if (i == 10)
+            assert(state == Http_request_parser::parsing_request_line);
+        if (state == Http_request_parser::parsed) {
+            assert(parser.get_method() == "POST" && parser.get_target() == "/gip?cmd=data" && parser.get_version() == "HTTP/1.1");
+            assert(parser.get_field_count() == 3 && parser.find_field("HOST") == "a" && parser.find_field("accept-language") == "de" && parser.find_field("Accept").empty());
+            assert(parser.get_body() == "x=1\r\n" && parser.get_size() == request.length() - 3);
+        }
+    }
+    assert(state == Http_request_parser::parsed && input.length() == request.length() - 3);
+    parser.reset();
+    assert(parser.parse("GET", 3) == Http_request_parser::parsing_request_line);
+    // the limits fail the request before it has been received completely
+    const string cookie = "GET / HTTP/1.1\r\nCookie: " + string(128, 'x');
+    assert(parser.parse(cookie.data(), cookie.length()) == Http_request_parser::parse_failed);
+    parser.reset();
+    const string body = "POST / HTTP/1.1\r\nContent-Length: 17\r\n\r\n";
+    assert(parser.parse(body.data(), body.length()) == Http_request_parser::parse_failed);
+    parser.reset();
+    const string invalid = "GET\r\n\r\n";
+    assert(parser.parse(invalid.data(), invalid.length()) == Http_request_parser::parse_failed);
+}
+
+#ifndef PLATFORM_WIN
+static void test_http_response()
+{
+    const char* filepath = "/tmp/net-response-test.txt";
+    FILE* file = fopen(filepath, "w");
+    fputs("file\n", file);
+    fclose(file);
+    Http_fragment_ref fragment(new Http_fragment("fragment\n"));
+    Http_service_response_ref response(new Http_service_response());
+    string content = "content\n";
+    response->append(fragment);
+    assert(response->append_file(filepath) && !response->append_file("/tmp/net-response-missing.txt"));
+    response->adopt(content);
+    assert(content.empty() && response->get_content_length() == 22);
+    response->set_header("header\n");
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    Socket_tcp_ref socket(new Socket_tcp(fds[0]));
+    assert(response->send(socket) == 1);
+    char buf[64];
+    ssize_t len = ::recv(fds[1], buf, sizeof(buf), 0);
+    assert(string(buf, len > 0 ? len : 0) == "header\nfragment\nfile\ncontent\n");
+    socket->close();
+    ::close(fds[1]);
+    ::remove(filepath);
+}
+
+static void test_static_files()
+{
+    const char* filepath = "/tmp/net-static-test.html";
+    FILE* file = fopen(filepath, "w");
+    fputs("<p>static</p>\n", file);
+    fclose(file);
+    assert(!Http_static_cache::get_content_type("/gip/geo-ip.php") && !Http_static_cache::get_content_type("/img.d/file"));
+    assert(string(Http_static_cache::get_content_type("/gip/img/client.PNG")) == "image/png");
+    Http_static_cache cache;
+    cache.configure(4, 16, 0);
+    Http_static_file_ref cached = cache.find(filepath);
+    assert(cached && cached->get_content() && cached->get_content()->get_text() == "<p>static</p>\n");
+    assert(!cached->is_modified(cached->get_etag(), "") && !cached->is_modified("*", ""));
+    assert(!cached->is_modified("", cached->get_last_modified()) && cached->is_modified("\"0-0\"", cached->get_last_modified()));
+    assert(cache.find(filepath) == cached && cache.get_hits() == 1 && cache.get_misses() == 1);
+    // a changed file is loaded again, beyond the memory limit it is sent from its file
+    file = fopen(filepath, "w");
+    fputs("<p>static file</p>\n", file);
+    fclose(file);
+    Http_static_file_ref reloaded = cache.find(filepath);
+    assert(reloaded && reloaded != cached && !reloaded->get_content() && reloaded->get_file() >= 0 && reloaded->get_size() == 19);
+    Http_service_response_ref response(new Http_service_response());
+    response->append(reloaded);
+    response->append(cached);
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    Socket_tcp_ref socket(new Socket_tcp(fds[0]));
+    assert(response->send(socket) == 1);
+    char buf[64];
+    ssize_t len = ::recv(fds[1], buf, sizeof(buf), 0);
+    assert(string(buf, len > 0 ? len : 0) == "<p>static file</p>\n<p>static</p>\n");
+    // the file stays open for the next response
+    response->clear();
+    response->append(reloaded);
+    assert(response->send(socket) == 1);
+    len = ::recv(fds[1], buf, sizeof(buf), 0);
+    assert(string(buf, len > 0 ? len : 0) == "<p>static file</p>\n");
+    socket->close();
+    ::close(fds[1]);
+    ::remove(filepath);
+    assert(!cache.find(filepath));
+}
+#endif
+
 #ifdef NETWORK_OBSERVER_SUPPORT
 static void test_network_observer()
 {
@@ -315,6 +510,16 @@ void Net_module::test()
     assert(u7 && u7->get_protocol() == "http" && u7->get_host() == "www.ftd.de" && u7->get_port() == 80 && u7->get_path() == "/politik/:berliner");
 #endif
     test_urls();
+    test_numeric_addresses();
+#if FEATURE_NET_EPOLL
+    test_timer_wheel();
+#endif
+    test_http_requests();
+    test_http_parser();
+#ifndef PLATFORM_WIN
+    test_http_response();
+    test_static_files();
+#endif
 #if TEST_ADDRESSES
     test_addresses();
 #endif
@@ -0,0 +1,202 @@
+//
+//  net_reactor.cpp
+//
+//  Created by Christian Lehner on 18/10/26.
+//  Copyright (c) 2019 Softhub. All rights reserved.
+//
+
+#include "stdafx.h"
+#include "net_reactor.h"
+#include <errno.h>
+#include <time.h>
+#if FEATURE_NET_EPOLL
+#include <sys/epoll.h>
+#endif
+
+using namespace SOFTHUB::BASE;
+using namespace std;
+
+namespace SOFTHUB {
+namespace NET {
+
+//
+// class Timer_wheel
+//
+
+Timer_wheel::Timer_wheel(size_t num_slots, int tick_msec) :
+    slots(num_slots), tick_msec(tick_msec), current(0), size(0), last_tick(now())
+{
+    assert(num_slots > 0 && tick_msec > 0);
+}
+
+void Timer_wheel::schedule(Reactor_handler* handler, int msec)
+{
+    cancel(handler);
+    size_t num_slots = slots.size();
+    size_t ticks = msec > tick_msec ? (msec + tick_msec - 1) / tick_msec : 1;
+    size_t slot = (current + ticks) % num_slots;
+    std::list<Reactor_handler*>& entries = slots[slot];
+    handler->timer_slot = (int) slot;
+    handler->timer_rounds = (unsigned) ((ticks - 1) / num_slots);
+    handler->timer_pos = entries.insert(entries.end(), handler);
+    size++;
+}
+
+void Timer_wheel::cancel(Reactor_handler* handler)
+{
+    if (handler->timer_slot < 0)
+        return;
+    slots[handler->timer_slot].erase(handler->timer_pos);
+    handler->timer_slot = -1;
+    size--;
+}
+
+void Timer_wheel::advance(long long time, Vector<Reactor_handler_ref>& expired)
+{
+    while (last_tick + tick_msec <= time) {
+        last_tick += tick_msec;
+        current = (current + 1) % slots.size();
+        std::list<Reactor_handler*>& entries = slots[current];
+        std::list<Reactor_handler*>::iterator it = entries.begin();
+        while (it != entries.end()) {
+            Reactor_handler* handler = *it;
+            if (handler->timer_rounds > 0) {
+                handler->timer_rounds--;
+                ++it;
+            } else {
+                it = entries.erase(it);
+                handler->timer_slot = -1;
+                size--;
+                expired.append(handler);
+            }
+        }
+    }
+}
+
+void Timer_wheel::reset(long long time)
+{
+    for (size_t i = 0, n = slots.size(); i < n; i++) {
+        std::list<Reactor_handler*>& entries = slots[i];
+        for (std::list<Reactor_handler*>::iterator it = entries.begin(); it != entries.end(); ++it)
+            (*it)->timer_slot = -1;
+        entries.clear();
+    }
+    current = 0;
+    size = 0;
+    last_tick = time;
+}
+
+int Timer_wheel::next_timeout(long long time) const
+{
+    long long msec = last_tick + tick_msec - time;
+    return msec > 0 ? (int) msec : 0;
+}
+
+long long Timer_wheel::now()
+{
+#ifdef PLATFORM_WIN
+    return (long long) GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+#if FEATURE_NET_EPOLL
+
+//
+// class Reactor
+//
+
+Reactor::Reactor() : poll_fd(::epoll_create1(EPOLL_CLOEXEC))
+{
+    if (poll_fd < 0)
+        log_message(ERR, "failed to create epoll instance");
+}
+
+Reactor::~Reactor()
+{
+    clear();
+    if (poll_fd >= 0)
+        ::close(poll_fd);
+}
+
+bool Reactor::add(Reactor_handler* handler)
+{
+    SOCKET fd = handler->get_socket()->get_socket_fd();
+    if (poll_fd < 0 || handlers.contains(fd))
+        return false;
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.fd = fd;
+    if (::epoll_ctl(poll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+        return false;
+    handlers.insert(fd, handler);
+    return true;
+}
+
+void Reactor::remove(Reactor_handler* handler)
+{
+    SOCKET fd = handler->get_socket()->get_socket_fd();
+    if (!contains(handler))
+        return;
+    timers.cancel(handler);
+    // the handler may be released with the map entry
+    Reactor_handler_ref ref(handler);
+    handlers.remove(fd);
+    ::epoll_ctl(poll_fd, EPOLL_CTL_DEL, fd, 0);
+}
+
+bool Reactor::contains(const Reactor_handler* handler) const
+{
+    Handlers::const_iterator it = handlers.find(handler->get_socket()->get_socket_fd());
+    return it != handlers.end() && it->second == handler;
+}
+
+int Reactor::poll(int timeout_msec)
+{
+    if (poll_fd < 0)
+        return -1;
+    if (!timers.empty())
+        timeout_msec = std::min(timeout_msec, timers.next_timeout(Timer_wheel::now()));
+    struct epoll_event events[max_events];
+    int count = ::epoll_wait(poll_fd, events, max_events, timeout_msec);
+    if (count < 0)
+        return errno == EINTR ? 0 : -1;
+    for (int i = 0; i < count; i++) {
+        // look up by descriptor, an earlier handler of this batch may have removed it
+        Handlers::iterator it = handlers.find(events[i].data.fd);
+        if (it == handlers.end())
+            continue;
+        Reactor_handler_ref handler = it->second;
+        unsigned mask = events[i].events;
+        if (mask & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            handler->on_readable(this);
+        if ((mask & EPOLLOUT) && contains(handler))
+            handler->on_writable(this);
+    }
+    Vector<Reactor_handler_ref> expired;
+    timers.advance(Timer_wheel::now(), expired);
+    for (size_t i = 0, n = expired.size(); i < n; i++) {
+        Reactor_handler* handler = expired[i];
+        if (contains(handler))
+            handler->on_timeout(this);
+    }
+    return count;
+}
+
+void Reactor::clear()
+{
+    timers.reset(Timer_wheel::now());
+    for (Handlers::iterator it = handlers.begin(); it != handlers.end(); ++it) {
+        if (poll_fd >= 0)
+            ::epoll_ctl(poll_fd, EPOLL_CTL_DEL, it->first, 0);
+        it->second->get_socket()->close();
+    }
+    handlers.clear();
+}
+
+#endif
+
+}}
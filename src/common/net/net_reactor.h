@@ -0,0 +1,122 @@
+//
+//  net_reactor.h
+//
+//  Created by Christian Lehner on 18/10/26.
+//  Copyright (c) 2019 Softhub. All rights reserved.
+//
+
+#ifndef NET_REACTOR_H
+#define NET_REACTOR_H
+
+#include "net_socket.h"
+#include <list>
+#include <vector>
+
+#ifndef FEATURE_NET_EPOLL
+#ifdef PLATFORM_LINUX
+#define FEATURE_NET_EPOLL 1
+#else
+#define FEATURE_NET_EPOLL 0
+#endif
+#endif
+
+namespace SOFTHUB {
+namespace NET {
+
+FORWARD_CLASS(Reactor);
+FORWARD_CLASS(Reactor_handler);
+
+//
+// class Reactor_handler
+//
+// Sockets are registered edge triggered, handlers have to read and write until the socket would block.
+//
+
+class Reactor_handler : public BASE::Object<> {
+
+    friend class Timer_wheel;
+
+    Socket_ref socket;
+    int timer_slot;
+    unsigned timer_rounds;
+    std::list<Reactor_handler*>::iterator timer_pos;
+
+public:
+    Reactor_handler(Socket* socket) : socket(socket), timer_slot(-1), timer_rounds(0) {}
+
+    const Socket* get_socket() const { return socket; }
+    Socket* get_socket() { return socket; }
+    bool has_timer() const { return timer_slot >= 0; }
+
+    virtual void on_readable(Reactor* reactor) = 0;
+    virtual void on_writable(Reactor* reactor) {}
+    virtual void on_timeout(Reactor* reactor) {}
+};
+
+//
+// class Timer_wheel
+//
+// Timeouts are hashed into slots of tick_msec each, a timeout longer than one turn of the wheel counts
+// down its rounds. Scheduling and cancelling are constant time.
+//
+
+class Timer_wheel {
+
+    std::vector<std::list<Reactor_handler*>> slots;
+    int tick_msec;
+    size_t current;
+    size_t size;
+    long long last_tick;
+
+public:
+    Timer_wheel(size_t num_slots = 512, int tick_msec = 100);
+
+    void schedule(Reactor_handler* handler, int msec);
+    void cancel(Reactor_handler* handler);
+    void advance(long long time, BASE::Vector<Reactor_handler_ref>& expired);
+    void reset(long long time);
+    int next_timeout(long long time) const;
+    size_t get_size() const { return size; }
+    bool empty() const { return size == 0; }
+
+    static long long now();
+};
+
+#if FEATURE_NET_EPOLL
+
+//
+// class Reactor
+//
+// Dispatches readiness events of non-blocking sockets and timeouts to their handlers on the polling thread.
+//
+
+class Reactor : public BASE::Object<> {
+
+    typedef BASE::Hash_map<SOCKET,Reactor_handler_ref> Handlers;
+
+    static const int max_events = 256;
+
+    int poll_fd;
+    Handlers handlers;
+    Timer_wheel timers;
+
+public:
+    Reactor();
+    ~Reactor();
+
+    bool is_open() const { return poll_fd >= 0; }
+    bool add(Reactor_handler* handler);
+    void remove(Reactor_handler* handler);
+    bool contains(const Reactor_handler* handler) const;
+    void schedule(Reactor_handler* handler, int msec) { timers.schedule(handler, msec); }
+    void cancel(Reactor_handler* handler) { timers.cancel(handler); }
+    int poll(int timeout_msec);
+    void clear();
+    size_t get_size() const { return handlers.size(); }
+};
+
+#endif
+
+}}
+
+#endif
@@ -8,6 +8,10 @@
 
 #include "stdafx.h"
 #include "net_server.h"
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #define DOCUMENT_ROOT "/var/www"
 
@@ -18,6 +22,195 @@ using namespace std;
 namespace SOFTHUB {
 namespace NET {
 
+//
+// class Http_buffer_pool
+//
+
+Http_buffer_pool::~Http_buffer_pool()
+{
+    for (size_t i = 0; i < buffers.size(); i++)
+        delete buffers[i];
+}
+
+string* Http_buffer_pool::acquire()
+{
+    {
+        Lock::Block lock(mutex);
+        if (!buffers.empty()) {
+            string* buffer = buffers.back();
+            buffers.pop_back();
+            return buffer;
+        }
+    }
+    return new string();
+}
+
+void Http_buffer_pool::release(string* buffer)
+{
+    buffer->clear();
+    if (buffer->capacity() <= max_pooled_size) {
+        Lock::Block lock(mutex);
+        if (buffers.size() < max_buffers) {
+            buffers.append(buffer);
+            return;
+        }
+    }
+    delete buffer;
+}
+
+//
+// class Http_static_file
+//
+
+Http_static_file::Http_static_file(const char* content_type, time_t mtime, size_t size) :
+    content_type(content_type), mtime(mtime), size(size), file(-1), validated(0)
+{
+    stringstream stream;
+    stream << "\"" << hex << size << "-" << mtime << "\"";
+    etag = stream.str();
+    last_modified = Http_server::formatted_date(mtime);
+}
+
+Http_static_file::~Http_static_file()
+{
+    if (file >= 0)
+        ::close(file);
+}
+
+bool Http_static_file::is_modified(const String_slice& if_none_match, const String_slice& if_modified_since) const
+{
+    // the tag decides when the client sent one, the date is compared as the client got it from us
+    if (!if_none_match.empty())
+        return if_none_match != "*" && if_none_match.to_string().find(etag) == string::npos;
+    if (!if_modified_since.empty())
+        return if_modified_since != last_modified;
+    return true;
+}
+
+bool Http_static_file::output(ostream& stream) const
+{
+    if (content) {
+        stream << content->get_text();
+        return true;
+    }
+    char buf[16384];
+    size_t pos = 0;
+    while (pos < size) {
+        ssize_t count = ::pread(file, buf, std::min(size - pos, sizeof(buf)), (off_t) pos);
+        if (count <= 0)
+            return false;
+        stream.write(buf, count);
+        pos += count;
+    }
+    return true;
+}
+
+//
+// class Http_static_cache
+//
+
+Http_static_cache::Http_static_cache() :
+    files(default_capacity), max_memory_size(default_max_memory_size), revalidate_interval(default_revalidate_interval),
+    hits(0), misses(0)
+{
+}
+
+void Http_static_cache::configure(size_t capacity, size_t max_memory_size, int revalidate_interval)
+{
+    Lock::Block lock(mutex);
+    files.set_capacity(capacity);
+    this->max_memory_size = max_memory_size;
+    this->revalidate_interval = revalidate_interval;
+}
+
+Http_static_file_ref Http_static_cache::find(const string& filepath)
+{
+    const char* content_type = get_content_type(filepath);
+    if (!content_type)
+        return 0;
+    time_t now = ::time(0);
+    Http_static_file_ref file;
+    {
+        Lock::Block lock(mutex);
+        if (files.get(filepath, file) && now - file->validated < revalidate_interval) {
+            hits++;
+            return file;
+        }
+    }
+    if (file) {
+        // an unchanged file is kept, the stat is the only access to the disk
+        struct stat st;
+        if (::stat(filepath.c_str(), &st) == 0 && st.st_mtime == file->mtime && (size_t) st.st_size == file->size) {
+            Lock::Block lock(mutex);
+            file->validated = now;
+            hits++;
+            return file;
+        }
+    }
+    misses++;
+    file = load(filepath, content_type);
+    Lock::Block lock(mutex);
+    if (!file) {
+        files.remove(filepath);
+        return 0;
+    }
+    file->validated = now;
+    if (files.get_capacity() > 0)
+        files.store(filepath, file);
+    return file;
+}
+
+Http_static_file_ref Http_static_cache::load(const string& filepath, const char* content_type)
+{
+    int fd = ::open(filepath.c_str(), O_RDONLY);
+    if (fd < 0)
+        return 0;
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return 0;
+    }
+    Http_static_file_ref file(new Http_static_file(content_type, st.st_mtime, (size_t) st.st_size));
+    if (file->size > max_memory_size) {
+        // the responses send the file from the open descriptor, which is closed with the last of them
+        file->file = fd;
+        return file;
+    }
+    string text(file->size, '\0');
+    size_t pos = 0;
+    while (pos < text.length()) {
+        ssize_t count = ::read(fd, &text[pos], text.length() - pos);
+        if (count <= 0)
+            break;
+        pos += count;
+    }
+    ::close(fd);
+    if (pos < text.length())
+        return 0;
+    file->content = new Http_fragment(text);
+    return file;
+}
+
+const char* Http_static_cache::get_content_type(const string& path)
+{
+    static const char* types[][2] = {
+        { "html", "text/html" }, { "htm", "text/html" }, { "css", "text/css" }, { "js", "application/javascript" },
+        { "json", "application/json" }, { "txt", "text/plain" }, { "png", "image/png" }, { "jpg", "image/jpeg" },
+        { "jpeg", "image/jpeg" }, { "gif", "image/gif" }, { "svg", "image/svg+xml" }, { "ico", "image/x-icon" }
+    };
+    // only files of these types are served, scripts and files without an extension are not
+    size_t dot = path.rfind('.');
+    if (dot == string::npos || path.find('/', dot) != string::npos)
+        return 0;
+    string ext = path.substr(dot + 1);
+    Strings::to_lower(ext);
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (ext == types[i][0])
+            return types[i][1];
+    }
+    return 0;
+}
+
 //
 // class Http_server
 //
@@ -25,7 +218,10 @@ namespace NET {
 NET::Address_const_ref Http_server::default_server_address = Address::create(default_port);
 
 Http_server::Http_server() :
-    Server(default_server_address), user_agent("Softhub"), send_timeout(12000), receive_timeout(12000), http_port(default_port), use_ssl(false)
+    Server(default_server_address), user_agent("Softhub"), send_timeout(12000), receive_timeout(12000), http_port(default_port), use_ssl(false),
+    num_workers(default_workers), backlog_size(default_backlog), workers_stopped(true), event_mode(false),
+    idle_timeout(default_idle_timeout), keep_alive_timeout(default_keep_alive_timeout), max_requests(default_max_requests),
+    max_body_size(default_max_body_size), compress_min_size(default_compress_min_size)
 {
 }
 
@@ -44,6 +240,20 @@ void Http_server::configure(const IConfig* config)
     http_port = port ? port : url->get_port();
     Address* address = Address::create(http_port);
     set_server_address(address);
+    num_workers = std::max(config->get_parameter("server-threads", (int) default_workers), 0);
+    backlog_size = std::max(config->get_parameter("server-backlog", (int) default_backlog), 1);
+    idle_timeout = std::max(config->get_parameter("server-idle-timeout", (int) default_idle_timeout), 1);
+    keep_alive_timeout = std::max(config->get_parameter("server-keep-alive-timeout", (int) default_keep_alive_timeout), 1);
+    max_requests = std::max(config->get_parameter("server-max-requests", (int) default_max_requests), 1);
+    max_body_size = std::max(config->get_parameter("server-max-body-size", (int) default_max_body_size), 0);
+    compress_min_size = std::max(config->get_parameter("server-compress-min-size", (int) default_compress_min_size), 0);
+    int static_capacity = config->get_parameter("server-static-cache-size", (int) Http_static_cache::default_capacity);
+    int static_memory_size = config->get_parameter("server-static-memory-size", (int) Http_static_cache::default_max_memory_size);
+    int static_revalidate = config->get_parameter("server-static-revalidate", (int) Http_static_cache::default_revalidate_interval);
+    static_files.configure(std::max(static_capacity, 0), std::max(static_memory_size, 0), std::max(static_revalidate, 0));
+    const string& mode = config->get_parameter("server-mode", "threads");
+    // the secure sockets only work blocking
+    event_mode = FEATURE_NET_EPOLL && mode == "events" && !use_ssl;
 }
 
 Socket_tcp* Http_server::create_socket() const
@@ -78,6 +288,11 @@ bool Http_server::initialize()
     stringstream stream;
     stream << "server bound to " << server_address->to_string();
     report_error(stream.str());
+#if FEATURE_NET_EPOLL
+    if (event_mode && start_reactor())
+        return true;
+#endif
+    start_workers();
     return true;
 }
 
@@ -87,6 +302,169 @@ void Http_server::finalize()
         server_socket->close();
         server_socket = 0;
     }
+#if FEATURE_NET_EPOLL
+    stop_reactor();
+#endif
+    stop_workers();
+}
+
+void Http_server::start_workers()
+{
+    Lock::Block lock(connection_mutex);
+    if (!workers.empty())
+        return;
+    workers_stopped = false;
+    for (int i = 0; i < num_workers; i++) {
+        Thread* thread = new Thread(new Http_worker(this));
+        workers.append(thread);
+        thread->start();
+    }
+}
+
+void Http_server::stop_workers()
+{
+    Vector<Thread*> threads;
+    {
+        Lock::Block lock(connection_mutex);
+        workers_stopped = true;
+        threads.swap(workers);
+        for (size_t i = 0; i < threads.size(); i++)
+            connection_condition.signal();
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i]->join();
+        delete threads[i];
+    }
+    Lock::Block lock(connection_mutex);
+    while (!connections.empty()) {
+        connections.front().second->close();
+        connections.pop_front();
+    }
+}
+
+bool Http_server::dispatch(const Address* client, Socket_tcp* socket)
+{
+    Lock::Block lock(connection_mutex);
+    if (workers_stopped || connections.size() >= backlog_size)
+        return false;
+    connections.push_back(Connection(client, socket));
+    connection_condition.signal();
+    return true;
+}
+
+bool Http_server::next_connection(Address_const_ref& client, Socket_tcp_ref& socket)
+{
+    Lock::Block lock(connection_mutex);
+    while (connections.empty() && !workers_stopped)
+        connection_condition.wait(connection_mutex);
+    if (workers_stopped)
+        return false;
+    client = connections.front().first;
+    socket = connections.front().second;
+    connections.pop_front();
+    return true;
+}
+
+void Http_server::serve_unavailable(Socket_tcp* socket)
+{
+    log_message(WARN, "connection queue full, request rejected");
+    const string content = "server busy\n";
+    stringstream stream;
+    serve_header("503 Service Unavailable", "text/plain", content.length(), stream);
+    stream << endl;
+    stream << content;
+    socket->set_send_timeout(send_timeout);
+    send(stream.str(), socket);
+    socket->close();
+}
+
+#if FEATURE_NET_EPOLL
+
+bool Http_server::start_reactor()
+{
+    Reactor_ref events(new Reactor());
+    if (!events->is_open())
+        return false;
+    server_socket->set_non_blocking(true);
+    if (!events->add(new Http_event_listener(this, server_socket))) {
+        server_socket->set_non_blocking(false);
+        return false;
+    }
+    reactor = events;
+    return true;
+}
+
+void Http_server::stop_reactor()
+{
+    if (reactor) {
+        reactor->clear();
+        reactor = 0;
+    }
+}
+
+void Http_server::serve_events()
+{
+    // the service loop pauses between requests, so keep polling here until the server stops
+    while (!is_stopped()) {
+        if (reactor->poll(500) < 0)
+            throw Exception("failed to poll server sockets");
+    }
+}
+
+#endif
+
+bool Http_server::serve_buffer(const Address* client, Socket_tcp* socket, const Http_request_parser& parser, bool& keep_alive, Http_service_response_ref& response)
+{
+    Http_service_request_ref request(new Http_service_request(this, client, socket, &parser));
+    if (!request->parse_header()) {
+        log_message(INFO, "failed to parse request parameters");
+        keep_alive = false;
+        return false;
+    }
+    response = new Http_service_response();
+    keep_alive = keep_alive && is_persistent(request->get_header());
+    response->set_keep_alive(keep_alive);
+    response->set_accepted_coding(negotiate_coding(request->find_field("accept-encoding")));
+    if (!serve_static(request, response))
+        serve_page(request, response);
+    // without a response the client is told nothing, so the connection is closed
+    if (response->empty())
+        keep_alive = false;
+    return true;
+}
+
+bool Http_server::serve_static(const Http_service_request* sreq, Http_service_response* sres)
+{
+    const Http_request_header* header = sreq->get_header();
+    Http_request_method method = header->get_method();
+    if (method != get_method && method != head_method)
+        return false;
+    const string& url_path = header->get_path();
+    string path = url_path.substr(0, url_path.find('?'));
+    // requests for files of other types go to the pages, nothing outside the document root is served
+    if (!Http_static_cache::get_content_type(path) || path.find("..") != string::npos)
+        return false;
+    Http_static_file_ref file = find_static_file(path);
+    if (!file) {
+        serve_error_page("file not found", sres);
+        return true;
+    }
+    bool modified = file->is_modified(sreq->find_field("if-none-match"), sreq->find_field("if-modified-since"));
+    stringstream stream;
+    serve_header(modified ? "200 OK" : "304 Not Modified", file->get_content_type(), file->get_size(), stream, sres->is_keep_alive());
+    stream << "ETag: " << file->get_etag() << endl;
+    stream << "Last-Modified: " << file->get_last_modified() << endl;
+    stream << endl;
+    if (modified && method != head_method)
+        sres->append(file);
+    sres->set_header(stream.str());
+    return true;
+}
+
+Http_static_file_ref Http_server::find_static_file(const string& path)
+{
+    size_t pos = path.find_first_not_of('/');
+    return static_files.find(File_path::concat(document_root, pos == string::npos ? "" : path.substr(pos)));
 }
 
 void Http_server::stop()
@@ -100,11 +478,20 @@ void Http_server::serve_request()
 {
     if (!server_socket)
         return;
+#if FEATURE_NET_EPOLL
+    if (reactor) {
+        serve_events();
+        return;
+    }
+#endif
     Address_ref client(new Address_ip4());
     Socket_tcp_ref socket;
     Status status = server_socket->accept(client, socket);
     if (status == SUCCESS && socket) {
-        serve(client, socket);
+        if (num_workers == 0)
+            serve(client, socket);
+        else if (!dispatch(client, socket))
+            serve_unavailable(socket);
     } else {
         server_socket->close();
     }
@@ -112,28 +499,50 @@ void Http_server::serve_request()
 
 void Http_server::serve(const Address* client, Socket_tcp* socket)
 {
-    Http_service_request_ref request(new Http_service_request(this, client, socket));
-    if (request->parse_url_parameters()) {
-        Http_service_response_ref response(new Http_service_response());
-        serve_page(request, response);
-        const string& content = response->get_content();
-        if (content.length() > 0) {
-            socket->set_send_timeout(send_timeout);
-            socket->set_recieve_timeout(receive_timeout);
-            Status status = send(content, socket);
-            if (status != SUCCESS) {
-                stringstream stream;
-                stream << "failed to send, status: " << status;
-                log_message(INFO, stream.str());
-            }
+    socket->set_send_timeout(send_timeout);
+    Http_buffer_pool::Buffer input(buffers);
+    Http_request_parser parser(max_header_size, max_body_size);
+    Http_service_response_ref response;
+    int served = 0;
+    bool keep_alive = true;
+    while (keep_alive) {
+        Http_request_parser::State state = parser.parse(input->data(), input->length());
+        if (state == Http_request_parser::parse_failed) {
+            log_message(INFO, "invalid request from " + client->to_string());
+            break;
+        }
+        if (state != Http_request_parser::parsed) {
+            // the first request is expected right away, a following one within the keep alive timeout
+            int timeout = served == 0 || !input->empty() ? receive_timeout : keep_alive_timeout;
+            if (!receive(socket, timeout, *input))
+                break;
+            continue;
+        }
+        keep_alive = ++served < max_requests && !is_stopped();
+        bool parsed = serve_buffer(client, socket, parser, keep_alive, response);
+        input->erase(0, parser.get_size());
+        parser.reset();
+        if (!parsed || response->empty())
+            break;
+        if (response->send(socket) <= 0) {
+            log_message(INFO, "failed to send response to " + client->to_string());
+            break;
         }
-    } else {
-        log_message(INFO, "failed to parse request parameters");
     }
-    // do we need flag to keep sockets open?
     socket->close();
 }
 
+bool Http_server::receive(Socket_tcp* socket, int timeout, string& input)
+{
+    char buf[16384];
+    socket->set_recieve_timeout(timeout);
+    int count = socket->recv(buf, sizeof(buf));
+    if (count <= 0)
+        return false;
+    input.append(buf, count);
+    return true;
+}
+
 Status Http_server::send(const string& msg, Socket_tcp* socket)
 {
     int count, response_len = (int) msg.length();
@@ -145,16 +554,20 @@ Status Http_server::send(const string& msg, Socket_tcp* socket)
     return count >= 0 ? SUCCESS : SEND_ERR;
 }
 
-void Http_server::serve_header(const string& status, const string& content_type, size_t content_length, ostream& stream)
+void Http_server::serve_header(const string& status, const string& content_type, size_t content_length, ostream& stream, bool keep_alive, Http_content_coding coding)
 {
     time_t now;
     time(&now);
-    stream << "HTTP/1.0 " << status << endl;
+    stream << "HTTP/1.1 " << status << endl;
     stream << "Date: " << formatted_date(now) << endl;
     stream << "Server: " << user_agent << endl;
     stream << "Content-Type: " << content_type << endl;
     stream << "Content-Length: " << content_length << endl;
-    stream << "Connection: close" << endl;
+    if (coding != identity_coding) {
+        stream << "Content-Encoding: " << get_coding_name(coding) << endl;
+        stream << "Vary: Accept-Encoding" << endl;
+    }
+    stream << "Connection: " << (keep_alive ? "keep-alive" : "close") << endl;
 }
 
 void Http_server::serve_error_page_content(const string& msg, ostream& stream)
@@ -174,12 +587,13 @@ void Http_server::serve_error_page(const string& msg, Http_service_response* sre
     log_message(INFO, stream.str());
     stringstream content_stream;
     serve_error_page_content(msg, content_stream);
-    const string& content = content_stream.str();
-    stringstream page_stream;
-    serve_header("404 Not Found", "text/html", content.length(), page_stream);
-    page_stream << endl;
-    page_stream << content;
-    sres->set_content(page_stream.str());
+    // parts of the page which failed are dropped
+    sres->clear();
+    sres->append(content_stream.str());
+    stringstream header_stream;
+    serve_header("404 Not Found", "text/html", sres->get_content_length(), header_stream, sres->is_keep_alive());
+    header_stream << endl;
+    sres->set_header(header_stream.str());
 }
 
 bool Http_server::user_agent_is_mobile(const std::string& user_agent)
@@ -222,30 +636,247 @@ void Http_server::parse_optional_parameters(const Url_parameters& parameters, st
     }
 }
 
+Http_content_coding Http_server::negotiate_coding(const String_slice& accept_encoding)
+{
+    // the codings are weighted by their q value, gzip is preferred over deflate if both weigh the same
+    float gzip_q = -1, deflate_q = -1, any_q = -1;
+    size_t pos = 0;
+    while (pos < accept_encoding.length()) {
+        size_t end = accept_encoding.find(',', pos);
+        if (end == string::npos)
+            end = accept_encoding.length();
+        String_slice element = accept_encoding.substr(pos, end - pos);
+        pos = end + 1;
+        size_t sep = element.find(';');
+        String_slice name = element.substr(0, sep);
+        size_t b = 0, e = name.length();
+        while (b < e && isspace((unsigned char) name[b]))
+            b++;
+        while (e > b && isspace((unsigned char) name[e - 1]))
+            e--;
+        name = name.substr(b, e - b);
+        float q = 1;
+        if (sep != string::npos) {
+            const string& params = element.substr(sep + 1).to_string();
+            size_t qpos = params.find("q=");
+            if (qpos != string::npos)
+                q = (float) atof(params.c_str() + qpos + 2);
+        }
+        if (name.equals_ignore_case("gzip") || name.equals_ignore_case("x-gzip"))
+            gzip_q = q;
+        else if (name.equals_ignore_case("deflate"))
+            deflate_q = q;
+        else if (name == "*")
+            any_q = q;
+    }
+    if (gzip_q < 0)
+        gzip_q = any_q;
+    if (deflate_q < 0)
+        deflate_q = any_q;
+    if (gzip_q > 0 && gzip_q >= deflate_q)
+        return gzip_coding;
+    return deflate_q > 0 ? deflate_coding : identity_coding;
+}
+
+const char* Http_server::get_coding_name(Http_content_coding coding)
+{
+    switch (coding) {
+    case gzip_coding:
+        return "gzip";
+    case deflate_coding:
+        return "deflate";
+    default:
+        return "identity";
+    }
+}
+
+bool Http_server::is_persistent(const Http_request_header* header)
+{
+    // HTTP/1.1 connections persist unless the client closes them, HTTP/1.0 ones only when asked for
+    const string& connection = header->get_connection();
+    if (header->get_version() == "HTTP/1.1")
+        return connection.find("close") == string::npos;
+    return connection.find("keep-alive") != string::npos;
+}
+
 string Http_server::formatted_date(time_t t)
 {
     char buf[128];
-    const struct tm* ts = localtime(&t);
+    const struct tm* ts = gmtime(&t);
     strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", ts);
     // return time in this format "Date: Mon, 22 Apr 2019 11:55:00 GMT"
     return buf;
 }
 
+//
+// class Http_worker
+//
+
+void Http_worker::run()
+{
+    Address_const_ref client;
+    Socket_tcp_ref socket;
+    while (server->next_connection(client, socket)) {
+        try {
+            server->serve(client, socket);
+        } catch (Exception& ex) {
+            log_message(ERR, "http worker: " + ex.get_message());
+            socket->close();
+        }
+        client = 0;
+        socket = 0;
+    }
+}
+
+void Http_worker::fail(const exception& ex)
+{
+    log_message(ERR, ex.what());
+}
+
+#if FEATURE_NET_EPOLL
+
+//
+// class Http_event_listener
+//
+
+void Http_event_listener::on_readable(Reactor* reactor)
+{
+    Socket_tcp* listener = static_cast<Socket_tcp*>(get_socket());
+    for (;;) {
+        Address_ref client(new Address_ip4());
+        Socket_tcp_ref socket;
+        // stops when no connection is pending or the process ran out of descriptors
+        if (listener->accept(client, socket) != SUCCESS || !socket)
+            break;
+        socket->set_non_blocking(true);
+        socket->no_sig_pipe(1);
+        Http_event_connection_ref connection(new Http_event_connection(server, client, socket));
+        if (reactor->add(connection))
+            reactor->schedule(connection, server->idle_timeout);
+        else
+            socket->close();
+    }
+}
+
+//
+// class Http_event_connection
+//
+
+Http_event_connection::Http_event_connection(Http_server* server, const Address* client, Socket_tcp* socket) :
+    Reactor_handler(socket), server(server), client(client), input(server->buffers),
+    parser(Http_server::max_header_size, server->max_body_size), served(0), responding(false),
+    keep_alive(false), peer_closed(false)
+{
+}
+
+void Http_event_connection::on_readable(Reactor* reactor)
+{
+    char buf[16384];
+    int count;
+    while ((count = get_socket()->recv(buf, sizeof(buf))) > 0) {
+        input->append(buf, count);
+        // requests waiting behind the current one are limited to the size of a request as well
+        if (input->length() > Http_server::max_header_size + server->max_body_size) {
+            log_message(INFO, "request too large from " + client->to_string());
+            close(reactor);
+            return;
+        }
+    }
+    if (count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        peer_closed = true;
+    // while a response is being sent, further requests wait in the input
+    if (!responding)
+        respond(reactor);
+}
+
+void Http_event_connection::on_writable(Reactor* reactor)
+{
+    if (responding && flush(reactor))
+        respond(reactor);
+}
+
+void Http_event_connection::respond(Reactor* reactor)
+{
+    // pipelined requests are answered one after the other as long as the responses can be sent at once
+    while (!responding) {
+        Http_request_parser::State state = parser.parse(input->data(), input->length());
+        if (state == Http_request_parser::parse_failed) {
+            log_message(INFO, "invalid request from " + client->to_string());
+            close(reactor);
+            return;
+        }
+        if (state != Http_request_parser::parsed) {
+            if (peer_closed)
+                close(reactor);
+            else
+                reactor->schedule(this, input->empty() ? server->idle_timeout : server->receive_timeout);
+            return;
+        }
+        responding = true;
+        keep_alive = !peer_closed && ++served < server->max_requests;
+        Socket_tcp* socket = static_cast<Socket_tcp*>(get_socket());
+        try {
+            if (!server->serve_buffer(client, socket, parser, keep_alive, output))
+                output = 0;
+        } catch (Exception& ex) {
+            log_message(ERR, "http connection: " + ex.get_message());
+            output = 0;
+            keep_alive = false;
+        }
+        input->erase(0, parser.get_size());
+        parser.reset();
+        reactor->schedule(this, server->send_timeout);
+        if (!flush(reactor))
+            return;
+    }
+}
+
+void Http_event_connection::on_timeout(Reactor* reactor)
+{
+    close(reactor);
+}
+
+bool Http_event_connection::flush(Reactor* reactor)
+{
+    int result = output ? output->send(get_socket()) : -1;
+    if (result == 0)
+        return true;
+    if (result < 0 || !keep_alive) {
+        close(reactor);
+        return false;
+    }
+    responding = false;
+    output = 0;
+    return true;
+}
+
+void Http_event_connection::close(Reactor* reactor)
+{
+    Socket_ref socket = get_socket();
+    reactor->remove(this);
+    socket->close();
+}
+
+#endif
+
 //
 // class Http_service_request
 //
 
-Http_service_request::Http_service_request(Http_server* server, const Address* client, Socket_tcp* socket) :
-    server(server), bytes_read(0), bytes_remaining(0), parameters(0), parameter_map(0), client(client), socket(socket)
+Http_service_request::Http_service_request(Http_server* server, const Address* client, Socket_tcp* socket, const Http_request_parser* parser) :
+    server(server), parser(parser), parameters(0), parameter_map(0), client(client), socket(socket)
+{
+}
+
+Http_service_request::~Http_service_request()
 {
+    delete parameters;
+    delete parameter_map;
 }
 
 string Http_service_request::get_data() const
 {
-    int idx = max_buf_size - bytes_remaining;
-    int n = bytes_read - idx;
-    assert(n >= 0);
-    return string(&buffer[idx], n);
+    return parser->get_body().to_string();
 }
 
 string Http_service_request::get_user_ip() const
@@ -287,42 +918,33 @@ const Url_parameter_map& Http_service_request::get_parameter_map() const
     return *parameter_map;
 }
 
-bool Http_service_request::parse_url_parameters()
+bool Http_service_request::parse_header()
 {
-    int retry_cnt = 0;
-    while (++retry_cnt < 3 && (bytes_read = socket->recv(buffer, max_buf_size)) == 0);
-    if (bytes_read < 0) {
-        stringstream stream;
-        stream << "bad request from " << client->to_string() << " retries: " << retry_cnt << endl;
-        log_message(INFO, stream.str());
+    Http_request_header_ref parsed(new Http_request_header());
+    try {
+        parsed->assign(*parser);
+    } catch (Exception& ex) {
+        log_message(INFO, ex.get_message());
         return false;
     }
-    header = Http_request_header::parse_header(buffer, max_buf_size, bytes_remaining);
+    header = parsed;
     return true;
 }
 
 bool Http_service_request::parse_post_parameters() const
 {
-    int count = 0;
-    int idx = max_buf_size - bytes_remaining;
-    int n = bytes_read - idx;
-    assert(n >= 0);
-    if (n == 0) {
-        // TODO: loop on bytes_remaining
-        bytes_read = socket->recv(buffer, max_buf_size);
-        if (bytes_read <= 0)
-            return false;
-        idx = 0;
-        n = bytes_remaining = bytes_read;
-    }
-    string line;
-    string text(&buffer[idx], n);
-    stringstream line_stream(text);
-    while (getline(line_stream, line)) {
-        count += (int) line.length() + 1;
+    // the body has been received completely with the header
+    String_slice body = parser->get_body();
+    size_t pos = 0;
+    while (pos < body.length()) {
+        size_t eol = body.find('\n', pos);
+        if (eol == string::npos)
+            eol = body.length();
+        string line = body.substr(pos, eol - pos).to_string();
         Strings::trim(line);
         if (!line.empty())
             Url::parse_post_parameters(line, *parameters);
+        pos = eol + 1;
     }
     return true;
 }
@@ -331,8 +953,134 @@ bool Http_service_request::parse_post_parameters() const
 // class Http_service_response
 //
 
-Http_service_response::Http_service_response()
+Http_service_response::Http_service_response() :
+    content_length(0), sent_part(0), sent_pos(0), header_set(false), keep_alive(false), accepted_coding(identity_coding)
+{
+}
+
+Http_service_response::~Http_service_response()
+{
+    clear();
+}
+
+void Http_service_response::clear()
+{
+    for (size_t i = 0; i < parts.size(); i++) {
+        if (parts[i].file >= 0 && parts[i].owned)
+            ::close(parts[i].file);
+    }
+    parts.clear();
+    fragments.clear();
+    static_files.clear();
+    contents.clear();
+    content_length = 0;
+    sent_part = sent_pos = 0;
+    header_set = false;
+}
+
+void Http_service_response::append_part(const char* data, size_t length, int file, bool owned)
+{
+    Part part = { data, length, file, 0, owned };
+    parts.append(part);
+    content_length += length;
+}
+
+void Http_service_response::set_header(const string& header)
+{
+    // the header carries the length of the content, so it is set last but sent first
+    assert(!header_set);
+    contents.push_back(header);
+    Part part = { contents.back().data(), header.length(), -1, 0, true };
+    parts.insert(0, part);
+    header_set = true;
+}
+
+void Http_service_response::append(const string& content)
+{
+    contents.push_back(content);
+    append_part(contents.back().data(), content.length(), -1);
+}
+
+void Http_service_response::adopt(string& content)
+{
+    // the characters are taken over without a copy, a deque does not move its elements when it grows
+    contents.push_back(string());
+    contents.back().swap(content);
+    append_part(contents.back().data(), contents.back().length(), -1);
+}
+
+void Http_service_response::append(const Http_fragment* fragment)
+{
+    fragments.append(fragment);
+    const string& text = fragment->get_text();
+    append_part(text.data(), text.length(), -1);
+}
+
+bool Http_service_response::append_file(const string& filepath)
 {
+    int file = ::open(filepath.c_str(), O_RDONLY);
+    if (file < 0)
+        return false;
+    struct stat st;
+    if (::fstat(file, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(file);
+        return false;
+    }
+    append_part(0, (size_t) st.st_size, file);
+    return true;
+}
+
+void Http_service_response::append(const Http_static_file* file)
+{
+    // the file is shared with the cache and the other responses sending it, it is not closed here
+    static_files.append(file);
+    if (file->get_content())
+        append(file->get_content());
+    else
+        append_part(0, file->get_size(), file->get_file(), false);
+}
+
+int Http_service_response::send(Socket* socket)
+{
+    while (sent_part < parts.size()) {
+        const Part& part = parts[sent_part];
+        if (sent_pos >= part.length) {
+            sent_part++;
+            sent_pos = 0;
+            continue;
+        }
+        int count;
+        if (part.file >= 0) {
+            count = socket->send_file(part.file, part.offset + sent_pos, part.length - sent_pos);
+        } else {
+            // the memory parts up to the next file go out together
+            Socket_buffer buffers[max_send_buffers];
+            int n = 0;
+            for (size_t i = sent_part; i < parts.size() && parts[i].file < 0 && n < max_send_buffers; i++) {
+                size_t pos = i == sent_part ? sent_pos : 0;
+                buffers[n].data = parts[i].data + pos;
+                buffers[n].length = parts[i].length - pos;
+                n++;
+            }
+            count = socket->send_buffers(buffers, n);
+        }
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (count <= 0)
+            return -1;
+        size_t remaining = count;
+        while (remaining > 0 && sent_part < parts.size()) {
+            size_t left = parts[sent_part].length - sent_pos;
+            if (remaining < left) {
+                sent_pos += remaining;
+                break;
+            }
+            remaining -= left;
+            sent_part++;
+            sent_pos = 0;
+        }
+    }
+    return 1;
 }
 
 }}
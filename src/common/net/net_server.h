@@ -11,7 +11,9 @@
 
 #include "net_address.h"
 #include "net_http.h"
+#include "net_reactor.h"
 #include <hal/hal.h>
+#include <deque>
 
 namespace SOFTHUB {
 namespace NET {
@@ -21,6 +23,11 @@ FORWARD_CLASS(Http_server);
 FORWARD_CLASS(Http_config);
 FORWARD_CLASS(Http_service_request);
 FORWARD_CLASS(Http_service_response);
+FORWARD_CLASS(Http_fragment);
+FORWARD_CLASS(Http_static_file);
+FORWARD_CLASS(Http_worker);
+FORWARD_CLASS(Http_event_listener);
+FORWARD_CLASS(Http_event_connection);
 
 typedef BASE::List<Server_ref> Server_list;
 
@@ -40,23 +47,200 @@ public:
     const Address* get_server_address() const { return server_address; }
 };
 
+//
+// class Http_buffer_pool
+//
+// Request buffers keep their capacity when they are returned, so the connections of a running server
+// read into buffers without allocating. A buffer grown beyond max_pooled_size by a large request is
+// released instead.
+//
+
+class Http_buffer_pool {
+
+    static const size_t max_buffers = 64;
+    static const size_t max_pooled_size = 65536;
+
+    HAL::Mutex mutex;
+    BASE::Vector<std::string*> buffers;
+
+public:
+    ~Http_buffer_pool();
+
+    std::string* acquire();
+    void release(std::string* buffer);
+
+    class Buffer {
+
+        Http_buffer_pool& pool;
+        std::string* buffer;
+
+    public:
+        Buffer(Http_buffer_pool& pool) : pool(pool), buffer(pool.acquire()) {}
+        ~Buffer() { pool.release(buffer); }
+
+        std::string& operator*() { return *buffer; }
+        std::string* operator->() { return buffer; }
+    };
+};
+
+//
+// class Http_fragment
+//
+// A piece of content rendered once and shared by the responses which send it.
+//
+
+class Http_fragment : public BASE::Object<> {
+
+    const std::string text;
+
+public:
+    Http_fragment(const std::string& text) : text(text) {}
+
+    const std::string& get_text() const { return text; }
+};
+
+//
+// class Http_static_file
+//
+// A file below the document root as it was when it was last loaded. Files up to the memory limit of
+// the cache are held as a fragment, larger ones are kept open and sent with sendfile. The tag and the
+// modification date let clients revalidate their copy.
+//
+
+class Http_static_file : public BASE::Object<> {
+
+    friend class Http_static_cache;
+
+    std::string content_type;
+    time_t mtime;
+    size_t size;
+    std::string etag;
+    std::string last_modified;
+    Http_fragment_const_ref content;
+    int file;
+    time_t validated;
+
+public:
+    Http_static_file(const char* content_type, time_t mtime, size_t size);
+    ~Http_static_file();
+
+    const std::string& get_content_type() const { return content_type; }
+    time_t get_mtime() const { return mtime; }
+    size_t get_size() const { return size; }
+    const std::string& get_etag() const { return etag; }
+    const std::string& get_last_modified() const { return last_modified; }
+    const Http_fragment* get_content() const { return content; }
+    int get_file() const { return file; }
+    bool is_modified(const BASE::String_slice& if_none_match, const BASE::String_slice& if_modified_since) const;
+    bool output(std::ostream& stream) const;
+};
+
+//
+// class Http_static_cache
+//
+// The files below the document root by their path. A file asked for again within revalidate_interval
+// seconds is served as it is, later its modification time and size are checked with stat and a changed
+// file is loaded again. So the files sent most often are neither opened nor read per request.
+//
+
+class Http_static_cache {
+
+    HAL::Mutex mutex;
+    BASE::Cache<std::string,Http_static_file_ref> files;
+    size_t max_memory_size;
+    int revalidate_interval;
+    std::atomic<unsigned long> hits;
+    std::atomic<unsigned long> misses;
+
+    Http_static_file_ref load(const std::string& filepath, const char* content_type);
+
+public:
+    static const int default_capacity = 256;
+    static const int default_max_memory_size = 65536;
+    static const int default_revalidate_interval = 1;
+
+    Http_static_cache();
+
+    void configure(size_t capacity, size_t max_memory_size, int revalidate_interval);
+    Http_static_file_ref find(const std::string& filepath);
+    unsigned long get_hits() const { return hits; }
+    unsigned long get_misses() const { return misses; }
+
+    static const char* get_content_type(const std::string& path);
+};
+
 //
 // class Http_server
 //
+// Accepted connections are queued and served by a number of worker threads. When the queue is full,
+// further connections are answered with 503. Without workers, requests are served by the accepting
+// thread one after the other. In event mode a single thread serves all connections from a reactor, idle
+// connections only cost their buffers until they time out. Connections persist for up to max_requests
+// requests, pipelined requests are answered in the order they were received. A worker waits at most
+// keep_alive_timeout for the next request, so idle clients do not hold the workers for long. Requests
+// are parsed while they arrive, in buffers taken from a pool. Files of a known type below the document
+// root are served from a cache, clients holding the current version are answered with 304.
+//
 
 class Http_server : public Server {
 
+    friend class Http_worker;
+    friend class Http_event_listener;
+    friend class Http_event_connection;
+
+    typedef std::pair<Address_const_ref,Socket_tcp_ref> Connection;
+
+    static const size_t max_header_size = 16384;
+
     std::string user_agent;
     std::string document_root;
     int send_timeout;
     int receive_timeout;
     int http_port;
     bool use_ssl;
+    int num_workers;
+    size_t backlog_size;
+    HAL::Mutex connection_mutex;
+    HAL::Condition connection_condition;
+    std::deque<Connection> connections;
+    BASE::Vector<HAL::Thread*> workers;
+    bool workers_stopped;
+    bool event_mode;
+    int idle_timeout;
+    int keep_alive_timeout;
+    int max_requests;
+    size_t max_body_size;
+    size_t compress_min_size;
+    Http_buffer_pool buffers;
+    Http_static_cache static_files;
+#if FEATURE_NET_EPOLL
+    Reactor_ref reactor;
+#endif
 
     Socket_tcp* create_socket() const;
+    void start_workers();
+    void stop_workers();
+    bool dispatch(const Address* client, Socket_tcp* socket);
+    bool next_connection(Address_const_ref& client, Socket_tcp_ref& socket);
+    void serve_unavailable(Socket_tcp* socket);
+    bool receive(Socket_tcp* socket, int timeout, std::string& input);
+    bool serve_buffer(const Address* client, Socket_tcp* socket, const Http_request_parser& parser, bool& keep_alive, Http_service_response_ref& response);
+    bool serve_static(const Http_service_request* sreq, Http_service_response* sres);
+#if FEATURE_NET_EPOLL
+    bool start_reactor();
+    void stop_reactor();
+    void serve_events();
+#endif
 
 public:
     static const int default_port = 8080;
+    static const int default_workers = 4;
+    static const int default_backlog = 64;
+    static const int default_idle_timeout = 60000;
+    static const int default_keep_alive_timeout = 5000;
+    static const int default_max_requests = 100;
+    static const int default_max_body_size = 1 << 20;
+    static const int default_compress_min_size = 1024;
     static Address_const_ref default_server_address;
 
 protected:
@@ -69,12 +253,14 @@ protected:
     void set_user_agent(const std::string& user_agent) { this->user_agent = user_agent; }
     const std::string& get_user_agent() const { return user_agent; }
     const std::string& get_document_root() const { return document_root; }
+    size_t get_compress_min_size() const { return compress_min_size; }
+    const Http_static_cache& get_static_files() const { return static_files; }
+    Http_static_file_ref find_static_file(const std::string& path);
 
     Status send(const std::string& msg, Socket_tcp* socket);
 
     static bool user_agent_is_mobile(const std::string& user_agent);
     static void parse_optional_parameters(const Url_parameters& parameters, std::string& language, bool& mobile, std::string& address);
-    static std::string formatted_date(time_t t);
 
 public:
     Http_server();
@@ -84,39 +270,108 @@ public:
     void stop();
 
     virtual void serve(const Address* client, Socket_tcp* socket);
-    virtual void serve_header(const std::string& status, const std::string& content_type, size_t content_length, std::ostream& stream);
+    virtual void serve_header(const std::string& status, const std::string& content_type, size_t content_length, std::ostream& stream, bool keep_alive = false, Http_content_coding coding = identity_coding);
     virtual void serve_page(const Http_service_request* sreq, Http_service_response* sres) = 0;
     virtual void serve_error_page(const std::string& msg, Http_service_response* sres);
     virtual void serve_error_page_content(const std::string& msg, std::ostream& stream);
+
+    static bool is_persistent(const Http_request_header* header);
+    static Http_content_coding negotiate_coding(const BASE::String_slice& accept_encoding);
+    static const char* get_coding_name(Http_content_coding coding);
+    static std::string formatted_date(time_t t);
+};
+
+//
+// class Http_worker
+//
+
+class Http_worker : public BASE::Object<HAL::Runnable> {
+
+    Http_server_weak_ref server;
+
+public:
+    Http_worker(Http_server* server) : server(server) {}
+
+    void run();
+    void fail(const std::exception& ex);
 };
 
+#if FEATURE_NET_EPOLL
+
+//
+// class Http_event_listener
+//
+
+class Http_event_listener : public Reactor_handler {
+
+    Http_server* server;
+
+public:
+    Http_event_listener(Http_server* server, Socket_tcp* socket) : Reactor_handler(socket), server(server) {}
+
+    void on_readable(Reactor* reactor);
+};
+
+//
+// class Http_event_connection
+//
+
+class Http_event_connection : public Reactor_handler {
+
+    Http_server* server;
+    Address_const_ref client;
+    Http_buffer_pool::Buffer input;
+    Http_request_parser parser;
+    Http_service_response_ref output;
+    int served;
+    bool responding;
+    bool keep_alive;
+    bool peer_closed;
+
+    void close(Reactor* reactor);
+    void respond(Reactor* reactor);
+    bool flush(Reactor* reactor);
+
+public:
+    Http_event_connection(Http_server* server, const Address* client, Socket_tcp* socket);
+
+    void on_readable(Reactor* reactor);
+    void on_writable(Reactor* reactor);
+    void on_timeout(Reactor* reactor);
+};
+
+#endif
+
 //
 // class Http_service_request
 //
 
+//
+// The parser and its buffer belong to the connection, they are valid while the request is served.
+//
+
 class Http_service_request : public BASE::Object<> {
 
     friend class Http_server;
 
-    static const int max_buf_size = 4096;
-
     Http_server_ref server;
-    mutable char buffer[max_buf_size];  // TODO: this must become variable
-    mutable int bytes_read;
-    mutable int bytes_remaining;
-    mutable Http_request_header_ref header;
+    const Http_request_parser* parser;
+    Http_request_header_ref header;
     mutable Url_parameters* parameters;
     mutable Url_parameter_map* parameter_map;
     Address_const_ref client;
     mutable Socket_tcp_ref socket;
 
-    bool parse_url_parameters();
+    bool parse_header();
     bool parse_post_parameters() const;
 
 public:
-    Http_service_request(Http_server* server, const Address* client, Socket_tcp* socket);
+    Http_service_request(Http_server* server, const Address* client, Socket_tcp* socket, const Http_request_parser* parser);
+    ~Http_service_request();
 
     const Http_request_header* get_header() const { return header; }
+    BASE::String_slice find_field(const BASE::String_slice& name) const { return parser->find_field(name); }
+    BASE::String_slice get_body() const { return parser->get_body(); }
     std::string get_data() const;
     const Url_parameters& get_parameters() const;
     const Url_parameter_map& get_parameter_map() const;
@@ -128,17 +383,56 @@ public:
 //
 // class Http_service_response
 //
+// A response is a list of parts sent in one go, the header first. The memory parts are gathered into
+// a single sendmsg and files are handed to sendfile, so the content is not copied into a send buffer.
+// Sending continues where it stopped when a non blocking socket is full, send returns 1 once all parts
+// are sent, 0 when the socket is full and -1 on an error.
+//
 
 class Http_service_response : public BASE::Object<> {
 
-    std::string content;
+    struct Part {
+        const char* data;
+        size_t length;
+        int file;
+        size_t offset;
+        bool owned;
+    };
+
+    std::deque<std::string> contents;
+    BASE::Vector<Http_fragment_const_ref> fragments;
+    BASE::Vector<Http_static_file_const_ref> static_files;
+    BASE::Vector<Part> parts;
+    size_t content_length;
+    size_t sent_part;
+    size_t sent_pos;
+    bool header_set;
+    bool keep_alive;
+    Http_content_coding accepted_coding;
+
+    static const int max_send_buffers = 64;
+
+    void append_part(const char* data, size_t length, int file, bool owned = true);
 
 public:
     Http_service_response();
-
-    void set_content(const std::string& content) { this->content = content; }
-    const std::string& get_content() const { return content; }
-    std::string& get_content() { return content; } // TODO: refactor and remove this
+    ~Http_service_response();
+
+    void set_keep_alive(bool state) { keep_alive = state; }
+    bool is_keep_alive() const { return keep_alive; }
+    void set_accepted_coding(Http_content_coding coding) { accepted_coding = coding; }
+    Http_content_coding get_accepted_coding() const { return accepted_coding; }
+
+    void clear();
+    void set_header(const std::string& header);
+    void append(const std::string& content);
+    void adopt(std::string& content);
+    void append(const Http_fragment* fragment);
+    bool append_file(const std::string& filepath);
+    void append(const Http_static_file* file);
+    size_t get_content_length() const { return content_length; }
+    bool empty() const { return parts.empty(); }
+    int send(Socket* socket);
 };
 
 }}
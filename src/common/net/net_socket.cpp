@@ -11,11 +11,15 @@
 #include "net_module.h"
 #include "net_address.h"
 #include <fcntl.h>
+#ifdef PLATFORM_LINUX
+#include <sys/sendfile.h>
+#endif
 
 #ifdef PLATFORM_WIN
 #include <Ws2tcpip.h>
 #else
 #include <ifaddrs.h>
+#include <sys/uio.h>
 #define INVALID_SOCKET -1
 #define BOOL int
 #define FALSE 0
@@ -217,6 +221,60 @@ int Socket::send(const char* buf, int len)
 #endif
 }
 
+int Socket::send_buffers(const Socket_buffer* buffers, int count)
+{
+    assert(socket != INVALID_SOCKET);
+#ifdef PLATFORM_WIN
+    return count > 0 ? send(buffers[0].data, (int) buffers[0].length) : 0;
+#else
+    struct iovec iov[max_send_buffers];
+    if (count > max_send_buffers)
+        count = max_send_buffers;
+    for (int i = 0; i < count; i++) {
+        iov[i].iov_base = (void*) buffers[i].data;
+        iov[i].iov_len = buffers[i].length;
+    }
+    // unlike writev, sendmsg takes the flags which keep a closed peer from raising SIGPIPE
+    struct msghdr msg;
+    ::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+#ifdef PLATFORM_LINUX
+    return (int) ::sendmsg(socket, &msg, send_flags);
+#else
+    return (int) ::sendmsg(socket, &msg, 0);
+#endif
+#endif
+}
+
+int Socket::send_file(int fd, size_t offset, size_t count)
+{
+    assert(socket != INVALID_SOCKET);
+#ifdef PLATFORM_LINUX
+    off_t pos = (off_t) offset;
+    return (int) ::sendfile(socket, fd, &pos, std::min(count, (size_t) 0x40000000));
+#else
+    return copy_file(fd, offset, count);
+#endif
+}
+
+int Socket::copy_file(int fd, size_t offset, size_t count)
+{
+    // sends one chunk of the file through send, for sockets which cannot hand the file to the kernel
+    char buf[16384];
+    size_t n = std::min(count, sizeof(buf));
+#ifdef PLATFORM_WIN
+    if (::_lseek(fd, (long) offset, SEEK_SET) < 0)
+        return -1;
+    int len = ::_read(fd, buf, (unsigned) n);
+#else
+    int len = (int) ::pread(fd, buf, n, (off_t) offset);
+#endif
+    if (len <= 0)
+        return -1;
+    return send(buf, len);
+}
+
 int Socket::recv(char* buf, int len)
 {
     assert(socket != INVALID_SOCKET);
@@ -385,6 +443,17 @@ int Socket_tcp_secure_client::send(const char* buf, int len)
     return status;
 }
 
+int Socket_tcp_secure_client::send_buffers(const Socket_buffer* buffers, int count)
+{
+    // the buffers are encrypted one by one
+    return count > 0 ? send(buffers[0].data, (int) buffers[0].length) : 0;
+}
+
+int Socket_tcp_secure_client::send_file(int fd, size_t offset, size_t count)
+{
+    return copy_file(fd, offset, count);
+}
+
 int Socket_tcp_secure_client::recv(char* buf, int len)
 {
     assert(socket != INVALID_SOCKET);
@@ -478,6 +547,17 @@ int Socket_tcp_secure_server::send(const char* buf, int len)
     return status;
 }
 
+int Socket_tcp_secure_server::send_buffers(const Socket_buffer* buffers, int count)
+{
+    // the buffers are encrypted one by one
+    return count > 0 ? send(buffers[0].data, (int) buffers[0].length) : 0;
+}
+
+int Socket_tcp_secure_server::send_file(int fd, size_t offset, size_t count)
+{
+    return copy_file(fd, offset, count);
+}
+
 int Socket_tcp_secure_server::recv(char* buf, int len)
 {
 #ifdef _DEBUG
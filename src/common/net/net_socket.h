@@ -35,6 +35,15 @@ FORWARD_CLASS(Socket_tcp_secure_client);
 FORWARD_CLASS(Socket_tcp_secure_server);
 FORWARD_CLASS(Socket_udp);
 
+//
+// struct Socket_buffer
+//
+
+struct Socket_buffer {
+    const char* data;
+    size_t length;
+};
+
 //
 // class Socket
 //
@@ -42,6 +51,8 @@ FORWARD_CLASS(Socket_udp);
 class Socket : public BASE::Object<> {
 
 protected:
+    static const int max_send_buffers = 64;
+
     SOCKET socket;
 #ifdef PLATFORM_LINUX
     int send_flags;
@@ -52,6 +63,8 @@ protected:
     Socket(int family, int type, int protocol);
     Socket(SOCKET socket);
 
+    int copy_file(int fd, size_t offset, size_t count);
+
 public:
     Socket();
     virtual ~Socket();
@@ -70,6 +83,8 @@ public:
     virtual Status set_recieve_timeout(int msec);
     virtual Status close();
     virtual int send(const char* buf, int len);
+    virtual int send_buffers(const Socket_buffer* buffers, int count);
+    virtual int send_file(int fd, size_t offset, size_t count);
     virtual int recv(char* buf, int len);
 
     void find_all_interfaces(Addresses& addresses, int port);
@@ -107,6 +122,8 @@ public:
     Status connect(const Address* address);
     Status accept(Address* address, Socket_tcp_ref& accepting_socket);
     int send(const char* buf, int len);
+    int send_buffers(const Socket_buffer* buffers, int count);
+    int send_file(int fd, size_t offset, size_t count);
     int recv(char* buf, int len);
 };
 
@@ -129,6 +146,8 @@ public:
 
     Status accept(Address* address, Socket_tcp_ref& accepting_socket);
     int send(const char* buf, int len);
+    int send_buffers(const Socket_buffer* buffers, int count);
+    int send_file(int fd, size_t offset, size_t count);
     int recv(char* buf, int len);
 };
 
@@ -146,13 +146,17 @@ string Geo_latitude::to_string(Coordinate_format format) const
 
 Geo_latitude Geo_latitude::from_radians(double phi)
 {
-    double degree = phi * 180 / M_PI;
+    return from_degrees(phi * 180 / M_PI);
+}
+
+Geo_latitude Geo_latitude::from_degrees(double degree)
+{
     double abs_degree = fabs(degree);
     int h = (int) floor(abs_degree);
     double minutes = (abs_degree - h) * 60;
     int m = (int) floor(minutes);
     double s = (minutes - m) * 60;
-    Hemisphere hemi = phi >= 0 ? north : south;
+    Hemisphere hemi = degree >= 0 ? north : south;
     return Geo_latitude(h, m, s, hemi);
 }
 
@@ -186,13 +190,17 @@ string Geo_longitude::to_string(Coordinate_format format) const
 
 Geo_longitude Geo_longitude::from_radians(double lambda)
 {
-    double degree = lambda * 180 / M_PI;
+    return from_degrees(lambda * 180 / M_PI);
+}
+
+Geo_longitude Geo_longitude::from_degrees(double degree)
+{
     double abs_degree = fabs(degree);
     int h = (int) floor(abs_degree);
     double minutes = (abs_degree - h) * 60;
     int m = (int) floor(minutes);
     double s = (minutes - m) * 60;
-    Hemisphere hemi = lambda >= 0 ? east : west;
+    Hemisphere hemi = degree >= 0 ? east : west;
     return Geo_longitude(h, m, s, hemi);
 }
 
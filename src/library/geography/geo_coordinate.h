@@ -77,6 +77,7 @@ public:
     std::string to_string(Coordinate_format format = standard) const;
 
     static Geo_latitude from_radians(double phi);
+    static Geo_latitude from_degrees(double degree);
 #ifndef NO_GEO_PARSER
     static Geo_latitude parse(const std::string& s);
 #endif
@@ -97,6 +98,7 @@ public:
     std::string to_string(Coordinate_format format = standard) const;
 
     static Geo_longitude from_radians(double lambda);
+    static Geo_longitude from_degrees(double degree);
 #ifndef NO_GEO_PARSER
     static Geo_longitude parse(const std::string& s);
 #endif
@@ -1,4 +1,3 @@
-
 //
 //  geo_ip.h
 //
@@ -11,4 +10,48 @@
 
 typedef unsigned Geo_ip_num;
 
+#define GEO_IP_INDEX_MAGIC      0x78706967  // "gipx" in host byte order
+#define GEO_IP_INDEX_VERSION    1
+
+namespace SOFTHUB {
+namespace GEOGRAPHY {
+
+//
+// Layout of the ip range index file
+//
+// The file starts with a header followed by the range table, the record table and the string table.
+// Ranges are sorted by their lower bound and refer to a record, records refer to zero terminated
+// strings by offset. Records and strings are deduplicated. All values are in host byte order.
+//
+
+struct Geo_ip_index_header {
+    unsigned magic;
+    unsigned version;
+    unsigned range_count;
+    unsigned record_count;
+    unsigned ranges_offset;
+    unsigned records_offset;
+    unsigned strings_offset;
+    unsigned strings_size;
+};
+
+struct Geo_ip_index_range {
+    Geo_ip_num lo;
+    Geo_ip_num hi;
+    unsigned record;
+};
+
+struct Geo_ip_index_record {
+    unsigned country_code;
+    unsigned country;
+    unsigned state;
+    unsigned city;
+    unsigned zip;
+    unsigned tz;
+    float latitude;
+    float longitude;
+};
+
+}}
+
 #endif
@@ -13,6 +13,8 @@
 #include <net/net.h>
 #include <util/util.h>
 #include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
 #if _DEBUG_PERF
 #include <sys/time.h>
 #endif
@@ -164,12 +166,138 @@ size_t Geo_ip_entry::hash() const
     return range.hash() + std::hash<string>()(country_code) + std::hash<string>()(state) % std::hash<string>()(city) * coordinates.hash();
 }
 
+//
+// class Geo_ip_cache
+//
+
+Geo_ip_cache::Geo_ip_cache() : shards(0), num_shards(0), hits(0), misses(0), evictions(0)
+{
+}
+
+Geo_ip_cache::~Geo_ip_cache()
+{
+    delete[] shards;
+}
+
+void Geo_ip_cache::configure(size_t capacity, size_t num_shards, bool admission)
+{
+    delete[] shards;
+    shards = 0;
+    this->num_shards = 0;
+    if (capacity == 0 || num_shards == 0)
+        return;
+    if (num_shards > capacity)
+        num_shards = capacity;
+    shards = new Shard[num_shards];
+    for (size_t i = 0; i < num_shards; i++) {
+        shards[i].cache.set_capacity((capacity + num_shards - 1) / num_shards);
+        shards[i].cache.set_admission(admission);
+    }
+    this->num_shards = num_shards;
+}
+
+Geo_ip_cache::Shard& Geo_ip_cache::shard_of(Geo_ip_num ip_num) const
+{
+    // neighboring addresses of a subnet should not end up in the same shard
+    unsigned h = ip_num * 2654435761u;
+    return shards[(h >> 16) % num_shards];
+}
+
+bool Geo_ip_cache::find(Geo_ip_num ip_num, Geo_ip_entry_ref& entry)
+{
+    Shard& shard = shard_of(ip_num);
+    Lock::Block lock(shard.mutex);
+    if (!shard.cache.get(ip_num, entry)) {
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void Geo_ip_cache::store(Geo_ip_num ip_num, const Geo_ip_entry_ref& entry)
+{
+    Shard& shard = shard_of(ip_num);
+    Lock::Block lock(shard.mutex);
+    bool full = shard.cache.is_full() && !shard.cache.contains(ip_num);
+    shard.cache.store(ip_num, entry);
+    if (full && shard.cache.contains(ip_num))
+        evictions.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Geo_ip_cache::clear()
+{
+    for (size_t i = 0; i < num_shards; i++) {
+        Lock::Block lock(shards[i].mutex);
+        shards[i].cache.clear();
+    }
+}
+
+size_t Geo_ip_cache::get_size() const
+{
+    size_t size = 0;
+    for (size_t i = 0; i < num_shards; i++) {
+        Lock::Block lock(shards[i].mutex);
+        size += shards[i].cache.get_size();
+    }
+    return size;
+}
+
+size_t Geo_ip_cache::get_capacity() const
+{
+    return num_shards > 0 ? num_shards * shards[0].cache.get_capacity() : 0;
+}
+
 //
 // class Geo_ip_database
 //
 
 void Geo_ip_database::configure(IConfig* config)
 {
+    int capacity = config->get_parameter("geo-db-cache-size", 65536);
+    int num_shards = config->get_parameter("geo-db-cache-shards", 16);
+    const string& policy = config->get_parameter("geo-db-cache-policy", "lru");
+    cache.configure(std::max(capacity, 0), std::max(num_shards, 0), policy == "tinylfu");
+}
+
+Geo_ip_entry_ref Geo_ip_database::find(Geo_ip_num ip_num) const
+{
+    if (!cache.is_enabled())
+        return lookup(ip_num);
+    Geo_ip_entry_ref entry;
+    if (cache.find(ip_num, entry))
+        return entry;
+    entry = lookup(ip_num);
+    cache.store(ip_num, entry);
+    return entry;
+}
+
+Geo_ip_entry_ref Geo_ip_database::find(const Numeric_address& address) const
+{
+    // the dataset only holds IPv4 ranges
+    return address.is_ip4() ? find(address.get_ip4_number()) : nullptr;
+}
+
+Geo_ip_entry_ref Geo_ip_database::find(const Address* address) const
+{
+    if (address->get_length() != 4)
+        return 0;
+    return find(ntohl(address->get_addr_in().sin_addr.s_addr));
+}
+
+bool Geo_ip_database::locate(Geo_ip_num ip_num, Geo_ip_location& location) const
+{
+    // without a representation of its own the location is the entry found
+    Geo_ip_entry_ref entry = find(ip_num);
+    if (!entry)
+        return false;
+    location = Geo_ip_location(entry);
+    return true;
+}
+
+bool Geo_ip_database::locate(const Numeric_address& address, Geo_ip_location& location) const
+{
+    return address.is_ip4() && locate(address.get_ip4_number(), location);
 }
 
 string Geo_ip_database::map_language(const Geo_ip_entry* entry) const
@@ -201,6 +329,34 @@ string Geo_ip_database::geo_data_dir()
     return File_path::concat(data_dir, "geo-db");
 }
 
+string Geo_ip_database::geo_index_path()
+{
+    const IConfig* config = Base_module::get_configuration();
+    string data_dir = config->get_parameter("geo-db", DEFAULT_DATA);
+    return File_path::concat(data_dir, "geo-db.idx");
+}
+
+bool Geo_ip_database::use_index(const IConfig* config)
+{
+    const string& format = config->get_parameter("geo-db-format", "mmap");
+    return format != "tree";
+}
+
+bool Geo_ip_database::use_mapping(const IConfig* config)
+{
+    const string& format = config->get_parameter("geo-db-format", "mmap");
+    return format == "mmap";
+}
+
+Geo_ip_database* Geo_ip_database::create(IConfig* config)
+{
+    if (use_mapping(config))
+        return new Geo_ip_mapped_database();
+    if (use_index(config))
+        return new Geo_ip_index_database();
+    return new Geo_ip_file_database();
+}
+
 void Geo_ip_database::define_language(const string& country, const string& state, const string& language)
 {
     string key = country;
@@ -222,37 +378,24 @@ void Geo_ip_mem_database::configure(IConfig* config)
 
 int Geo_ip_mem_database::import(const string& filename)
 {
-    ifstream stream(filename);
-    if (!stream.good())
+    Geo_ip_csv_importer importer;
+    if (importer.import(filename))
         return -1;
-    data->remove_all();
-    string line, ip_from, ip_to, country_code, country, state, city, lat, lon, zip, tz;
-    while (stream.good()) {
-        getline(stream, line);
-        stringstream sstream(line);
-        next_column(sstream, ip_from);
-        next_column(sstream, ip_to);
-        next_column(sstream, country_code);
-        next_column(sstream, country);
-        next_column(sstream, state);
-        next_column(sstream, city);
-        next_column(sstream, lat);
-        next_column(sstream, lon);
-        next_column(sstream, zip);
-        next_column(sstream, tz);
-        unsigned lo = Address_ip4::aton(ip_from.c_str());
-        unsigned hi = Address_ip4::aton(ip_to.c_str());
-        const Geo_latitude& a = Geo_latitude::parse(lat);
-        const Geo_longitude& b = Geo_longitude::parse(lon);
-        Geo_coordinates coords(a, b);
-        Geo_ip_range range(4, lo, hi);
-        Geo_ip_entry* entry = new Geo_ip_entry(range, country_code, country, state, city, zip, tz, coords);
-        data->append(entry);
-    }
-    stream.close();
+    append(importer);
     return 0;
 }
 
+void Geo_ip_mem_database::append(const Geo_ip_csv_importer& importer)
+{
+    data->remove_all();
+    importer.for_each([this](const Geo_ip_csv_row& row) {
+        Geo_coordinates coords(Geo_latitude::from_degrees(row.latitude), Geo_longitude::from_degrees(row.longitude));
+        Geo_ip_range range(4, row.lo, row.hi);
+        data->append(new Geo_ip_entry(range, row.country_code.to_string(), row.country.to_string(), row.state.to_string(),
+            row.city.to_string(), row.zip.to_string(), row.tz.to_string(), coords));
+    });
+}
+
 int Geo_ip_mem_database::rebuild()
 {
     // TODO: this is old code and should be removed
@@ -269,19 +412,18 @@ int Geo_ip_mem_database::rebuild()
     return 0;
 }
 
-Geo_ip_entry_ref Geo_ip_mem_database::find(const Address* address) const
+Geo_ip_entry_ref Geo_ip_mem_database::lookup(Geo_ip_num ip_num) const
 {
 #if _DEBUG_PERF >= 8
+    Timing timing;
     timing.begin();
 #endif
-    byte len = (byte) address->get_length();
-    unsigned ip = ntohl(address->get_addr_in().sin_addr.s_addr);
-    Geo_ip_range range(len, ip, ip);
+    Geo_ip_range range(4, ip_num, ip_num);
     Geo_ip_entry_ref entry(new Geo_ip_entry(range));
     bool found = data->binary_search(entry);
 #if _DEBUG_PERF >= 8
     long msec = timing.end();
-    cdbg << "found address " << address->to_string(false) << " in " << msec << "ms" << endl;
+    cdbg << "found address " << range.to_string() << " in " << msec << "ms" << endl;
 #endif
     return found ? entry : nullptr;
 }
@@ -296,15 +438,6 @@ void Geo_ip_mem_database::deserialize(BASE::Deserializer* deserializer)
     deserializer->read(data);
 }
 
-void Geo_ip_mem_database::next_column(istream& stream, string& s)
-{
-    string tmp;
-    getline(stream, tmp, '"');
-    getline(stream, s, '"');
-    getline(stream, tmp, ',');
-    trim(s);
-}
-
 //
 // class Geo_ip_file_database
 //
@@ -312,7 +445,7 @@ void Geo_ip_mem_database::next_column(istream& stream, string& s)
 void Geo_ip_file_database::configure(IConfig* config)
 {
     Geo_ip_database::configure(config);
-    const string& data_dir = geo_data_dir();
+    data_dir = geo_data_dir();
     clog << "data " << data_dir << endl;
     if (!File_path::exists(data_dir))
         Geo_module::module.instance->recover_state();
@@ -386,21 +519,266 @@ Geo_ip_entry_ref Geo_ip_file_database::find_in_filesystem_recursively(const stri
 #endif
 }
 
-Geo_ip_entry_ref Geo_ip_file_database::find_in_filesystem(const Address* address) const
+Geo_ip_entry_ref Geo_ip_file_database::find_in_filesystem(Geo_ip_num ip_num) const
 {
-    Lock::Block lock(mutex);
-    string dir = geo_data_dir();
-    if (!File_path::exists(dir))
+    if (!File_path::exists(data_dir))
         return 0;
-    const string& addr_str = address->to_string(false);
     String_vector tokens;
-    String_util::split(addr_str, tokens, ".");
-    return find_in_filesystem_recursively(dir, tokens, 0);
+    for (int shift = 24; shift >= 0; shift -= 8)
+        tokens.append(std::to_string((ip_num >> shift) & 0xff));
+    return find_in_filesystem_recursively(data_dir, tokens, 0);
+}
+
+Geo_ip_entry_ref Geo_ip_file_database::find_in_filesystem(const Address* address) const
+{
+    return find_in_filesystem(ntohl(address->get_addr_in().sin_addr.s_addr));
+}
+
+Geo_ip_entry_ref Geo_ip_file_database::lookup(Geo_ip_num ip_num) const
+{
+    return find_in_filesystem(ip_num);
 }
 
-Geo_ip_entry_ref Geo_ip_file_database::find(const Address* address) const
+//
+// class Geo_ip_index_database
+//
+
+Geo_ip_index_database::Geo_ip_index_database() : fd(-1)
+{
+    memset(&header, 0, sizeof(header));
+}
+
+Geo_ip_index_database::~Geo_ip_index_database()
+{
+    close();
+}
+
+void Geo_ip_index_database::configure(IConfig* config)
+{
+    Geo_ip_database::configure(config);
+    const string& path = geo_index_path();
+    clog << "data " << path << endl;
+    if (!File_path::exists(path))
+        Geo_module::module.instance->recover_state();
+    if (!open(path))
+        clog << "cannot open ip index " << path << endl;
+}
+
+bool Geo_ip_index_database::open(const string& path)
+{
+    close();
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    ssize_t n = pread(fd, &header, sizeof(header), 0);
+    if (n != sizeof(header) || header.magic != GEO_IP_INDEX_MAGIC || header.version != GEO_IP_INDEX_VERSION) {
+        clog << "invalid ip index " << path << endl;
+        close();
+        return false;
+    }
+    strings.resize(header.strings_size);
+    n = header.strings_size ? pread(fd, &strings[0], header.strings_size, header.strings_offset) : 0;
+    // the string table ends with a terminator, so no string reaches beyond it
+    if (n != (ssize_t) header.strings_size || (header.strings_size > 0 && strings[header.strings_size - 1] != '\0')) {
+        clog << "truncated ip index " << path << endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void Geo_ip_index_database::close()
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    memset(&header, 0, sizeof(header));
+    strings.clear();
+}
+
+bool Geo_ip_index_database::read_range(unsigned idx, Geo_ip_index_range& range) const
+{
+    off_t offset = header.ranges_offset + (off_t) idx * sizeof(Geo_ip_index_range);
+    return pread(fd, &range, sizeof(range), offset) == sizeof(range);
+}
+
+bool Geo_ip_index_database::find_range(Geo_ip_num ip_num, Geo_ip_index_range& range) const
 {
-    return find_in_filesystem(address);
+    // find the last range with a lower bound not above ip_num
+    unsigned lo = 0, hi = header.range_count;
+    bool found = false;
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        Geo_ip_index_range probe;
+        if (!read_range(mid, probe))
+            return false;
+        if (probe.lo <= ip_num) {
+            range = probe;
+            found = true;
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return found && ip_num <= range.hi;
+}
+
+const char* Geo_ip_index_database::string_at(unsigned offset) const
+{
+    return offset < strings.size() ? strings.data() + offset : "";
+}
+
+Geo_ip_entry_ref Geo_ip_index_database::lookup(Geo_ip_num ip_num) const
+{
+    if (fd < 0)
+        return 0;
+#if _DEBUG_PERF >= 8
+    Timing timing;
+    timing.begin();
+#endif
+    Geo_ip_index_range range;
+    if (!find_range(ip_num, range) || range.record >= header.record_count)
+        return 0;
+    Geo_ip_index_record record;
+    off_t offset = header.records_offset + (off_t) range.record * sizeof(Geo_ip_index_record);
+    if (pread(fd, &record, sizeof(record), offset) != sizeof(record))
+        return 0;
+    const Geo_latitude& lat = Geo_latitude::from_radians(Geo_coordinate::to_radians<double>(record.latitude));
+    const Geo_longitude& lon = Geo_longitude::from_radians(Geo_coordinate::to_radians<double>(record.longitude));
+    Geo_coordinates coords(lat, lon);
+    Geo_ip_range ip_range(4, range.lo, range.hi);
+    Geo_ip_entry_ref entry = new Geo_ip_entry(ip_range, string_at(record.country_code), string_at(record.country),
+        string_at(record.state), string_at(record.city), string_at(record.zip), string_at(record.tz), coords);
+#if _DEBUG_PERF >= 8
+    long msec = timing.end();
+    cdbg << "found address " << ip_num << " in " << msec << "ms" << endl;
+#endif
+    return entry->is_valid() ? entry : nullptr;
+}
+
+//
+// class Geo_ip_location
+//
+
+bool Geo_ip_location::is_valid() const
+{
+    if (entry)
+        return entry->is_valid();
+    if (!record)
+        return false;
+    const String_slice& country = get_country();
+    const String_slice& state = get_state();
+    const String_slice& city = get_city();
+    const String_slice dash("-", 1);
+    return !country.empty() && country != dash && !state.empty() && state != dash && !city.empty() && city != dash;
+}
+
+Geo_ip_range Geo_ip_location::get_range() const
+{
+    return entry ? entry->get_range() : Geo_ip_range(4, range->lo, range->hi);
+}
+
+Geo_coordinates Geo_ip_location::get_coordinates() const
+{
+    if (entry)
+        return entry->get_coordinates();
+    const Geo_latitude& lat = Geo_latitude::from_radians(Geo_coordinate::to_radians<double>(record->latitude));
+    const Geo_longitude& lon = Geo_longitude::from_radians(Geo_coordinate::to_radians<double>(record->longitude));
+    return Geo_coordinates(lat, lon);
+}
+
+Geo_ip_entry_ref Geo_ip_location::get_entry() const
+{
+    if (entry || !record)
+        return entry;
+    return new Geo_ip_entry(get_range(), get_country_code().to_string(), get_country().to_string(), get_state().to_string(),
+        get_city().to_string(), get_zip().to_string(), get_tz().to_string(), get_coordinates());
+}
+
+//
+// class Geo_ip_mapped_database
+//
+
+Geo_ip_mapped_database::Geo_ip_mapped_database() :
+    header(0), ranges(0), records(0), strings(0)
+{
+}
+
+void Geo_ip_mapped_database::configure(IConfig* config)
+{
+    Geo_ip_database::configure(config);
+    const string& path = geo_index_path();
+    clog << "data " << path << endl;
+    if (!File_path::exists(path))
+        Geo_module::module.instance->recover_state();
+    if (!open(path))
+        clog << "cannot map ip index " << path << endl;
+}
+
+bool Geo_ip_mapped_database::open(const string& path)
+{
+    close();
+    if (!file.map(path))
+        return false;
+    const byte* data = file.get_data();
+    size_t size = file.get_size();
+    const Geo_ip_index_header* h = (const Geo_ip_index_header*) data;
+    bool valid = size >= sizeof(*h) && h->magic == GEO_IP_INDEX_MAGIC && h->version == GEO_IP_INDEX_VERSION &&
+        h->ranges_offset + (size_t) h->range_count * sizeof(Geo_ip_index_range) <= size &&
+        h->records_offset + (size_t) h->record_count * sizeof(Geo_ip_index_record) <= size &&
+        h->strings_offset + (size_t) h->strings_size <= size &&
+        h->strings_size > 0 && data[h->strings_offset + h->strings_size - 1] == '\0';
+    if (!valid) {
+        clog << "invalid ip index " << path << endl;
+        close();
+        return false;
+    }
+    header = h;
+    ranges = (const Geo_ip_index_range*) (data + h->ranges_offset);
+    records = (const Geo_ip_index_record*) (data + h->records_offset);
+    strings = (const char*) (data + h->strings_offset);
+    return true;
+}
+
+void Geo_ip_mapped_database::close()
+{
+    header = 0;
+    ranges = 0;
+    records = 0;
+    strings = 0;
+    file.unmap();
+}
+
+bool Geo_ip_mapped_database::find_record(Geo_ip_num ip_num, Geo_ip_location& location) const
+{
+    if (!header)
+        return false;
+    // find the first range with a lower bound above ip_num, the candidate is the one before
+    const Geo_ip_index_range* head = ranges;
+    const Geo_ip_index_range* tail = ranges + header->range_count;
+    const Geo_ip_index_range* it = std::upper_bound(head, tail, ip_num, [](Geo_ip_num ip, const Geo_ip_index_range& range) {
+        return ip < range.lo;
+    });
+    if (it == head)
+        return false;
+    const Geo_ip_index_range* range = it - 1;
+    if (ip_num > range->hi || range->record >= header->record_count)
+        return false;
+    location = Geo_ip_location(range, records + range->record, strings, header->strings_size);
+    return true;
+}
+
+bool Geo_ip_mapped_database::locate(Geo_ip_num ip_num, Geo_ip_location& location) const
+{
+    return find_record(ip_num, location) && location.is_valid();
+}
+
+Geo_ip_entry_ref Geo_ip_mapped_database::lookup(Geo_ip_num ip_num) const
+{
+    Geo_ip_location location;
+    if (!locate(ip_num, location))
+        return 0;
+    return location.get_entry();
 }
 
 }}
@@ -25,10 +25,14 @@
 namespace SOFTHUB {
 namespace GEOGRAPHY {
 
+class Geo_ip_csv_importer;
+
 FORWARD_CLASS(Geo_ip_entry);
 FORWARD_CLASS(Geo_ip_database);
 FORWARD_CLASS(Geo_ip_mem_database);
 FORWARD_CLASS(Geo_ip_file_database);
+FORWARD_CLASS(Geo_ip_index_database);
+FORWARD_CLASS(Geo_ip_mapped_database);
 DECLARE_ARRAY(Geo_ip_entry_ref, Geo_ip_data);
 
 typedef unsigned Geo_ip_num;
@@ -102,31 +106,129 @@ public:
     DECLARE_CLASS('sipe');
 };
 
+//
+// class Geo_ip_cache
+//
+// Bounded cache of lookup results in front of a database, keyed by the ip number. It is split into
+// shards with their own lock, so concurrent lookups rarely wait for each other. Addresses which are
+// not in the database are cached as well. With admission, rarely seen addresses do not evict others.
+//
+
+class Geo_ip_cache {
+
+    typedef BASE::Cache<Geo_ip_num,Geo_ip_entry_ref> Shard_cache;
+
+    struct Shard {
+        HAL::Mutex mutex;
+        Shard_cache cache;
+
+        Shard() : cache(0) {}
+    };
+
+    Shard* shards;
+    size_t num_shards;
+    std::atomic<unsigned long> hits;
+    std::atomic<unsigned long> misses;
+    std::atomic<unsigned long> evictions;
+
+    Shard& shard_of(Geo_ip_num ip_num) const;
+
+    Geo_ip_cache(const Geo_ip_cache&);
+    Geo_ip_cache& operator=(const Geo_ip_cache&);
+
+public:
+    Geo_ip_cache();
+    ~Geo_ip_cache();
+
+    void configure(size_t capacity, size_t num_shards, bool admission = false);
+    bool is_enabled() const { return num_shards > 0; }
+    bool find(Geo_ip_num ip_num, Geo_ip_entry_ref& entry);
+    void store(Geo_ip_num ip_num, const Geo_ip_entry_ref& entry);
+    void clear();
+    size_t get_size() const;
+    size_t get_capacity() const;
+    unsigned long get_hits() const { return hits.load(std::memory_order_relaxed); }
+    unsigned long get_misses() const { return misses.load(std::memory_order_relaxed); }
+    unsigned long get_evictions() const { return evictions.load(std::memory_order_relaxed); }
+};
+
+//
+// class Geo_ip_location
+//
+// The location of an address as found by Geo_ip_database::locate. For a mapped ip index it is a view of
+// the record in the mapped memory and only valid as long as the database it was found in, offsets
+// beyond the string table yield empty strings. The other databases hand out the entry they found.
+//
+
+class Geo_ip_location {
+
+    const Geo_ip_index_range* range;
+    const Geo_ip_index_record* record;
+    const char* strings;
+    size_t strings_size;
+    Geo_ip_entry_ref entry;
+
+    BASE::String_slice string_at(unsigned offset) const { return offset < strings_size ? BASE::String_slice(strings + offset) : BASE::String_slice(); }
+
+public:
+    Geo_ip_location() : range(0), record(0), strings(0), strings_size(0) {}
+    Geo_ip_location(const Geo_ip_index_range* range, const Geo_ip_index_record* record, const char* strings, size_t strings_size) :
+        range(range), record(record), strings(strings), strings_size(strings_size) {}
+    Geo_ip_location(Geo_ip_entry* entry) : range(0), record(0), strings(0), strings_size(0), entry(entry) {}
+
+    bool is_found() const { return record || entry; }
+    bool is_valid() const;
+    Geo_ip_range get_range() const;
+    Geo_coordinates get_coordinates() const;
+    BASE::String_slice get_country_code() const { return entry ? BASE::String_slice(entry->get_country_code()) : string_at(record->country_code); }
+    BASE::String_slice get_country() const { return entry ? BASE::String_slice(entry->get_country()) : string_at(record->country); }
+    BASE::String_slice get_state() const { return entry ? BASE::String_slice(entry->get_state()) : string_at(record->state); }
+    BASE::String_slice get_city() const { return entry ? BASE::String_slice(entry->get_city()) : string_at(record->city); }
+    BASE::String_slice get_zip() const { return entry ? BASE::String_slice(entry->get_zip()) : string_at(record->zip); }
+    BASE::String_slice get_tz() const { return entry ? BASE::String_slice(entry->get_tz()) : string_at(record->tz); }
+    Geo_ip_entry_ref get_entry() const;
+};
+
 //
 // class Geo_ip_database
 //
+// A database is set up by configure and is read only afterwards. The log listeners and the http
+// server share it, so find must be safe to call from several threads without locking. A reload
+// swaps in a new database while lookups may still hold the old one, which relies on the atomic
+// reference count of BASE::Object. Results of find are cached, subclasses implement lookup. locate
+// only creates an entry where the database has no other representation of the location, the log
+// listeners use it and create the entry of an address when it is added to their locations.
+//
 
 class Geo_ip_database : public BASE::Object<> {
 
-protected:
-    HAL::Mutex mutex;
-#if _DEBUG_PERF >= 8
-    UTIL::Timing timing;
-#endif
+    mutable Geo_ip_cache cache;
 
+protected:
     static BASE::String_map language_map;
 
     static void trim(std::string& s);
 
+    virtual Geo_ip_entry_ref lookup(Geo_ip_num ip_num) const = 0;
+
 public:
     Geo_ip_database() {}
 
-    void configure(BASE::IConfig* config);
+    virtual void configure(BASE::IConfig* config);
     std::string map_language(const Geo_ip_entry* entry) const;
-    virtual Geo_ip_entry_ref find(const NET::Address* address) const = 0;
+    Geo_ip_entry_ref find(Geo_ip_num ip_num) const;
+    Geo_ip_entry_ref find(const NET::Numeric_address& address) const;
+    Geo_ip_entry_ref find(const NET::Address* address) const;
+    virtual bool locate(Geo_ip_num ip_num, Geo_ip_location& location) const;
+    bool locate(const NET::Numeric_address& address, Geo_ip_location& location) const;
+    const Geo_ip_cache& get_cache() const { return cache; }
 
+    static Geo_ip_database* create(BASE::IConfig* config);
     static void define_language(const std::string& country, const std::string& state, const std::string& language);
     static std::string geo_data_dir();
+    static std::string geo_index_path();
+    static bool use_index(const BASE::IConfig* config);
+    static bool use_mapping(const BASE::IConfig* config);
 };
 
 //
@@ -139,14 +241,16 @@ class Geo_ip_mem_database : public Geo_ip_database {
 
     int rebuild();
 
-    static void next_column(std::istream& stream, std::string& s);
+protected:
+    Geo_ip_entry_ref lookup(Geo_ip_num ip_num) const;
 
 public:
     Geo_ip_mem_database() : data(new Geo_ip_data()) {}
 
+    const Geo_ip_data* get_data() const { return data; }
     void configure(BASE::IConfig* config);
     int import(const std::string& filename);
-    Geo_ip_entry_ref find(const NET::Address* address) const;
+    void append(const Geo_ip_csv_importer& importer);
     void serialize(BASE::Serializer* serializer) const;
     void deserialize(BASE::Deserializer* deserializer);
 
@@ -159,6 +263,9 @@ public:
 
 class Geo_ip_file_database : public Geo_ip_database {
 
+    std::string data_dir;
+
+    Geo_ip_entry_ref find_in_filesystem(Geo_ip_num ip_num) const;
     Geo_ip_entry_ref find_in_filesystem(const NET::Address* address) const;
     Geo_ip_entry_ref find_in_filesystem_recursively(const std::string& path, const BASE::String_vector& tokens, int idx) const;
     Geo_ip_entry_ref find_entry(const std::string& path, Geo_ip_num ip_num) const;
@@ -166,16 +273,83 @@ class Geo_ip_file_database : public Geo_ip_database {
 
     static Geo_ip_num ip_num_from_string_vector(const BASE::String_vector& tokens);
 
+protected:
+    Geo_ip_entry_ref lookup(Geo_ip_num ip_num) const;
+
 public:
     Geo_ip_file_database() {}
 
     void configure(BASE::IConfig* config);
-    Geo_ip_entry_ref find(const NET::Address* address) const;
     std::string map_language(const Geo_ip_entry* entry) const;
 
     DECLARE_CLASS('sifd');
 };
 
+//
+// class Geo_ip_index_database
+//
+// Looks up ip ranges in the single file index written by Geo_ip_index_writer. The range table is
+// binary searched on disk, only the header and the string table are held in memory.
+//
+
+class Geo_ip_index_database : public Geo_ip_database {
+
+    int fd;
+    Geo_ip_index_header header;
+    std::string strings;
+
+    bool open(const std::string& path);
+    void close();
+    bool read_range(unsigned idx, Geo_ip_index_range& range) const;
+    bool find_range(Geo_ip_num ip_num, Geo_ip_index_range& range) const;
+    const char* string_at(unsigned offset) const;
+
+protected:
+    Geo_ip_entry_ref lookup(Geo_ip_num ip_num) const;
+
+public:
+    Geo_ip_index_database();
+    ~Geo_ip_index_database();
+
+    void configure(BASE::IConfig* config);
+
+    DECLARE_CLASS('sixd');
+};
+
+//
+// class Geo_ip_mapped_database
+//
+// Maps the ip index into memory. The ranges are searched in place. locate returns a view of the
+// record found without allocating, find creates a Geo_ip_entry of it which the lookup cache keeps for
+// the following requests of the address.
+//
+
+class Geo_ip_mapped_database : public Geo_ip_database {
+
+    HAL::Mapped_file file;
+    const Geo_ip_index_header* header;
+    const Geo_ip_index_range* ranges;
+    const Geo_ip_index_record* records;
+    const char* strings;
+
+    bool open(const std::string& path);
+    void close();
+    bool find_record(Geo_ip_num ip_num, Geo_ip_location& location) const;
+
+protected:
+    Geo_ip_entry_ref lookup(Geo_ip_num ip_num) const;
+
+public:
+    Geo_ip_mapped_database();
+
+    void configure(BASE::IConfig* config);
+    bool locate(Geo_ip_num ip_num, Geo_ip_location& location) const;
+
+    using Geo_ip_database::locate;
+
+    DECLARE_CLASS('simx');
+};
+
 }}
 
 #endif
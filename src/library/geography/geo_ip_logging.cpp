@@ -9,8 +9,10 @@
 #include "stdafx.h"
 #include "geo_ip_server.h"
 #include "geo_ip_logging.h"
+#include "geo_ip_pipeline.h"
 #include "geo_module.h"
 #include <iomanip>
+#include <thread>
 
 using namespace SOFTHUB::BASE;
 using namespace SOFTHUB::HAL;
@@ -21,24 +23,165 @@ using namespace std;
 namespace SOFTHUB {
 namespace GEOGRAPHY {
 
+static int parse_digits(const char* p, int n)
+{
+    int value = 0;
+    for (int i = 0; i < n; i++) {
+        if (p[i] < '0' || p[i] > '9')
+            return -1;
+        value = value * 10 + p[i] - '0';
+    }
+    return n > 0 ? value : -1;
+}
+
+static int parse_month(const char* p)
+{
+    static const char* months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    for (int i = 0; i < 12; i++) {
+        if (::memcmp(p, months + i * 3, 3) == 0)
+            return i + 1;
+    }
+    return -1;
+}
+
+static time_t civil_time(int year, int month, int day, int hour, int min, int sec)
+{
+    // days since 1970-01-01 in the proleptic gregorian calendar, without the time zone of the process
+    int y = month <= 2 ? year - 1 : year;
+    int era = (y >= 0 ? y : y - 399) / 400;
+    long yoe = y - era * 400;
+    long doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    long days = era * 146097L + doe - 719468;
+    return (time_t) days * 86400 + hour * 3600 + min * 60 + sec;
+}
+
+//
+// class Geo_traffic
+//
+
+void Geo_traffic::add(unsigned time, unsigned count)
+{
+    size_t n = buckets.size();
+    if (n > first && buckets[n - 1].time == time) {
+        buckets[n - 1].count += count;
+    } else if (n == first || buckets[n - 1].time < time) {
+        Bucket bucket = { time, count };
+        buckets.append(bucket);
+    } else {
+        // a line older than the last one, as in a log of several writers
+        size_t i = n;
+        while (i > first && buckets[i - 1].time > time)
+            i--;
+        if (i > first && buckets[i - 1].time == time) {
+            buckets[i - 1].count += count;
+        } else {
+            Bucket bucket = { time, count };
+            buckets.insert(i, bucket);
+        }
+    }
+    total += count;
+}
+
+void Geo_traffic::merge(const Geo_traffic& traffic)
+{
+    for (size_t i = traffic.first; i < traffic.buckets.size(); i++)
+        add(traffic.buckets[i].time, traffic.buckets[i].count);
+}
+
+void Geo_traffic::expire(unsigned oldest)
+{
+    size_t n = buckets.size();
+    while (first < n && buckets[first].time < oldest)
+        total -= buckets[first++].count;
+    // the expired buckets are removed once they make up half of the vector
+    if (first == n) {
+        buckets.clear();
+        first = 0;
+    } else if (first * 2 >= n) {
+        buckets.erase(buckets.begin(), buckets.begin() + first);
+        first = 0;
+    }
+}
+
+unsigned Geo_traffic::count_since(unsigned time) const
+{
+    unsigned count = 0;
+    for (size_t i = buckets.size(); i > first && buckets[i - 1].time >= time; i--)
+        count += buckets[i - 1].count;
+    return count;
+}
+
 //
 // class Geo_log_data
 //
 
-Geo_log_data::Geo_log_data(const Address* address, const Geo_ip_entry* ip_entry) :
-    address(address), ip_entry(ip_entry), accesses(0)
+Geo_log_data::Geo_log_data(const Numeric_address& address, const Geo_ip_entry* ip_entry) :
+    address(address), ip_entry(ip_entry), modified(true)
+{
+}
+
+Geo_log_data::Geo_log_data(const Geo_log_data& data) :
+    address(data.address), ip_entry(data.ip_entry), traffic(data.traffic), modified(false)
+{
+}
+
+bool Geo_log_data::expire(unsigned oldest)
 {
+    unsigned total = traffic.get_total();
+    traffic.expire(oldest);
+    if (traffic.get_total() != total)
+        modified = true;
+    return traffic.is_empty();
+}
+
+void Geo_log_data::merge(const Geo_log_data* data)
+{
+    traffic.merge(data->traffic);
+    modified = true;
+}
+
+void Geo_log_data::save(Geo_log_checkpoint_location& location, string& strings) const
+{
+    location.ip_num = address.get_ip4_number();
+    location.flags = 0;
+    location.link = location.referer = location.client = 0;
+}
+
+bool Geo_log_data::restore(const Geo_log_checkpoint_location& location, const char* strings, size_t size)
+{
+    return true;
 }
 
 //
 // class Geo_access_log_data
 //
 
-Geo_access_log_data::Geo_access_log_data(const Address* address, const Geo_ip_entry* ip_entry) :
+Geo_access_log_data::Geo_access_log_data(const Numeric_address& address, const Geo_ip_entry* ip_entry) :
     Geo_log_data(address, ip_entry), robot(false), download(false)
 {
 }
 
+Geo_access_log_data::Geo_access_log_data(const Geo_access_log_data& data) :
+    Geo_log_data(data), link(data.link), referer(data.referer), client(data.client), robot(data.robot), download(data.download)
+{
+}
+
+void Geo_access_log_data::assign(string& field, const String_slice& value)
+{
+    // a long request line of a client does not make the location any larger
+    field.assign(value.data(), value.length() < max_field_length ? value.length() : max_field_length);
+}
+
+unsigned Geo_access_log_data::save_string(const string& field, string& strings)
+{
+    if (field.empty())
+        return 0;
+    unsigned offset = (unsigned) strings.length();
+    strings.append(field.c_str(), field.length() + 1);
+    return offset;
+}
+
 void Geo_access_log_data::check_link(const String_vector& sv)
 {
     string tmp = link;
@@ -53,6 +196,43 @@ void Geo_access_log_data::check_client(const String_vector& sv)
     robot |= Strings::match_string(tmp, sv);
 }
 
+void Geo_access_log_data::merge(const Geo_log_data* data)
+{
+    Geo_log_data::merge(data);
+    // the data merged in comes from later lines
+    const Geo_access_log_data* access_data = static_cast<const Geo_access_log_data*>(data);
+    if (!access_data->link.empty())
+        link = access_data->link;
+    if (!access_data->referer.empty())
+        referer = access_data->referer;
+    if (!access_data->client.empty())
+        client = access_data->client;
+    robot |= access_data->robot;
+    download |= access_data->download;
+}
+
+void Geo_access_log_data::save(Geo_log_checkpoint_location& location, string& strings) const
+{
+    Geo_log_data::save(location, strings);
+    location.flags = (robot ? robot_flag : 0) | (download ? download_flag : 0);
+    location.link = save_string(link, strings);
+    location.referer = save_string(referer, strings);
+    location.client = save_string(client, strings);
+}
+
+bool Geo_access_log_data::restore(const Geo_log_checkpoint_location& location, const char* strings, size_t size)
+{
+    // the string table ends with a zero, so an offset within it is a terminated string
+    if (location.link >= size || location.referer >= size || location.client >= size)
+        return false;
+    link = strings + location.link;
+    referer = strings + location.referer;
+    client = strings + location.client;
+    robot = (location.flags & robot_flag) != 0;
+    download = (location.flags & download_flag) != 0;
+    return true;
+}
+
 string Geo_access_log_data::get_img() const
 {
     return robot ? "robot.png" : (download ? "download.png" : "client.png");
@@ -64,14 +244,13 @@ void Geo_access_log_data::classify(const Geo_ip_server* server)
     check_link(downloads);
     const String_vector& bots = server->get_bots();
     check_client(bots);
-    increment_accesses();
 }
 
 //
 // class Geo_auth_log_data
 //
 
-Geo_auth_log_data::Geo_auth_log_data(const Address* address, const Geo_ip_entry* ip_entry) :
+Geo_auth_log_data::Geo_auth_log_data(const Numeric_address& address, const Geo_ip_entry* ip_entry) :
     Geo_log_data(address, ip_entry)
 {
 }
@@ -83,16 +262,46 @@ string Geo_auth_log_data::get_img() const
 
 void Geo_auth_log_data::classify(const Geo_ip_server* server)
 {
-    increment_accesses();
 }
 
+//
+// class Geo_log_snapshot
+//
+
+std::atomic<unsigned long> Geo_log_snapshot::next_version(0);
+
 //
 // class Geo_log_listener
 //
 
 Geo_log_listener::Geo_log_listener(Geo_ip_server* server) :
-    server(server), done(false)
+    location_drops(0), location_evictions(0), bucket_seconds(60), num_buckets(1440), checkpoint_interval(0),
+    checkpoint_time(0), checkpoint_pos(-1), checkpoint_ino(0), stream_pos(-1), stream_ino(0), server(server),
+    locations(default_capacity), changed(true), done(false)
 {
+    oldest_bucket = get_oldest_bucket(::time(0));
+    snapshot = new Geo_log_snapshot(bucket_seconds);
+}
+
+void Geo_log_listener::configure(const IConfig* config)
+{
+    bucket_seconds = std::max(config->get_parameter("geo-log-bucket-seconds", 60), 1);
+    num_buckets = std::max(config->get_parameter("geo-log-buckets", 1440), 1);
+    oldest_bucket = get_oldest_bucket(::time(0));
+    int capacity = config->get_parameter("geo-log-locations", (int) default_capacity);
+    const string& policy = config->get_parameter("geo-log-location-policy", "lru");
+    locations.set_capacity(std::max(capacity, 1));
+    locations.set_admission(policy == "tinylfu");
+    Geo_log_snapshot_ref next = new Geo_log_snapshot(bucket_seconds);
+    Lock::Block lock(snapshot_mutex);
+    snapshot = next;
+}
+
+Geo_log_listener* Geo_log_listener::create_configured_partial()
+{
+    Geo_log_listener* partial = create_partial();
+    partial->configure(server->get_config());
+    return partial;
 }
 
 void Geo_log_listener::run()
@@ -110,16 +319,320 @@ void Geo_log_listener::fail(const exception& ex)
 void Geo_log_listener::stop()
 {
     done = true;
+    if (pipeline)
+        pipeline->stop();
 }
 
-void Geo_log_listener::add_location(const Address* addr, Geo_log_data* data)
+void Geo_log_listener::start_pipeline(const string& key, int default_threads)
 {
-    locations.insert(addr, data);
+    IConfig* config = server->get_config();
+    int num_threads = config->get_parameter(key, default_threads);
+    if (num_threads <= 0)
+        return;
+    pipeline = new Geo_log_pipeline(this, num_threads);
+    pipeline->start();
+}
+
+unsigned Geo_log_listener::get_oldest_bucket(time_t now) const
+{
+    unsigned bucket = get_bucket(now);
+    return bucket >= (unsigned) num_buckets ? bucket - num_buckets + 1 : 0;
+}
+
+void Geo_log_listener::publish()
+{
+    // the buckets expire with the time passed, not with the time of the lines read
+    unsigned oldest = get_oldest_bucket(::time(0));
+    if (changed || oldest != oldest_bucket) {
+        oldest_bucket = oldest;
+        Geo_log_snapshot_ref previous = get_snapshot();
+        const Geo_locations& previous_locations = previous->locations;
+        Geo_log_snapshot_ref next = new Geo_log_snapshot(bucket_seconds);
+        Geo_locations& next_locations = next->locations;
+        Geo_location_table::const_iterator it = locations.begin();
+        while (it != locations.end()) {
+            // the list position of an expired location is left before it is removed
+            Geo_ip_num ip_num = it->first;
+            Geo_log_data_ref data = it->second;
+            ++it;
+            if (data->expire(oldest_bucket)) {
+                locations.remove(ip_num);
+                continue;
+            }
+            // the copy of an unchanged location is not changed by the previous snapshot either
+            Geo_log_data_ref copy;
+            if (!data->is_modified())
+                copy = previous_locations.get(ip_num);
+            if (!copy) {
+                copy = data->duplicate();
+                data->set_modified(false);
+            }
+            next_locations.insert(ip_num, copy);
+        }
+        {
+            Lock::Block lock(snapshot_mutex);
+            snapshot = next;
+        }
+        changed = false;
+    }
+    // only the main listener has a checkpoint, and only locations read up to a complete line are saved
+    bool moved = stream_pos != checkpoint_pos || stream_ino != checkpoint_ino;
+    if (!checkpoint_path.empty() && stream_pos >= 0 && stream_ino && moved && ::time(0) - checkpoint_time >= checkpoint_interval)
+        checkpoint();
+}
+
+bool Geo_log_listener::checkpoint()
+{
+    Vector<Geo_log_checkpoint_location> records;
+    Vector<Geo_log_checkpoint_bucket> buckets;
+    string strings(1, '\0');
+    for (Geo_location_table::const_iterator it = locations.begin(); it != locations.end(); ++it) {
+        const Geo_log_data* data = it->second;
+        const Geo_traffic& traffic = data->get_traffic();
+        Geo_log_checkpoint_location record;
+        data->save(record, strings);
+        record.bucket_count = (unsigned) traffic.get_size();
+        for (size_t i = 0; i < traffic.get_size(); i++) {
+            const Geo_traffic::Bucket& bucket = traffic.get_bucket(i);
+            Geo_log_checkpoint_bucket saved = { bucket.time, bucket.count };
+            buckets.append(saved);
+        }
+        records.append(record);
+    }
+    Geo_log_checkpoint_header header;
+    header.magic = GEO_LOG_CHECKPOINT_MAGIC;
+    header.version = GEO_LOG_CHECKPOINT_VERSION;
+    header.bucket_seconds = (unsigned) bucket_seconds;
+    header.location_count = (unsigned) records.size();
+    header.bucket_count = (unsigned) buckets.size();
+    header.strings_size = (unsigned) strings.size();
+    header.stream_pos = (ularge) stream_pos;
+    header.stream_ino = stream_ino;
+    checkpoint_time = ::time(0);
+    // the checkpoint replaces the previous one only once it is complete on disk
+    const string& tmp_path = checkpoint_path + ".tmp";
+    FILE* file = fopen(tmp_path.c_str(), "wb");
+    if (!file) {
+        clog << "cannot create " << tmp_path << endl;
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && (records.empty() || fwrite(records.data(), sizeof(Geo_log_checkpoint_location), records.size(), file) == records.size());
+    ok = ok && (buckets.empty() || fwrite(buckets.data(), sizeof(Geo_log_checkpoint_bucket), buckets.size(), file) == buckets.size());
+    ok = ok && fwrite(strings.data(), 1, strings.size(), file) == strings.size();
+    ok = ok && fflush(file) == 0 && ::fsync(fileno(file)) == 0;
+    if (fclose(file) != 0)
+        ok = false;
+    if (!ok || !File_path::rename_file(tmp_path, checkpoint_path)) {
+        clog << "cannot write " << checkpoint_path << endl;
+        File_path::remove_file(tmp_path);
+        return false;
+    }
+    checkpoint_pos = stream_pos;
+    checkpoint_ino = stream_ino;
+    return true;
 }
 
-void Geo_log_listener::clear_locations()
+bool Geo_log_listener::restore(const string& filepath, const string& name)
 {
-    locations.clear();
+    const IConfig* config = server->get_config();
+    checkpoint_interval = config->get_parameter("geo-log-checkpoint-interval", 60);
+    string path;
+    if (checkpoint_interval <= 0 || !File_path::app_data_path(path))
+        return false;
+    checkpoint_path = File_config::make_path(path, name, ".ckpt");
+    return restore_checkpoint(filepath, server->get_ip_database());
+}
+
+bool Geo_log_listener::restore_checkpoint(const string& filepath, const Geo_ip_database* database)
+{
+    Mapped_file file;
+    if (!file.map(checkpoint_path))
+        return false;
+    const byte* data = file.get_data();
+    size_t size = file.get_size();
+    const Geo_log_checkpoint_header* h = (const Geo_log_checkpoint_header*) data;
+    bool valid = size >= sizeof(*h) && h->magic == GEO_LOG_CHECKPOINT_MAGIC && h->version == GEO_LOG_CHECKPOINT_VERSION &&
+        sizeof(*h) + (size_t) h->location_count * sizeof(Geo_log_checkpoint_location) +
+        (size_t) h->bucket_count * sizeof(Geo_log_checkpoint_bucket) + h->strings_size == size &&
+        h->strings_size > 0 && data[size - 1] == '\0';
+    if (!valid || h->bucket_seconds != (unsigned) bucket_seconds) {
+        clog << "ignoring checkpoint " << checkpoint_path << endl;
+        return false;
+    }
+    // the log may have been rotated since the checkpoint, then it is continued in the first rotated log
+    struct stat st;
+    string resume_path = filepath;
+    if (::stat(resume_path.c_str(), &st) < 0 || (ularge) st.st_ino != h->stream_ino) {
+        resume_path = filepath + ".1";
+        if (::stat(resume_path.c_str(), &st) < 0 || (ularge) st.st_ino != h->stream_ino)
+            return false;
+    }
+    if ((ularge) st.st_size < h->stream_pos)
+        return false;
+    const Geo_log_checkpoint_location* records = (const Geo_log_checkpoint_location*) (data + sizeof(*h));
+    const Geo_log_checkpoint_bucket* buckets = (const Geo_log_checkpoint_bucket*) (records + h->location_count);
+    const char* strings = (const char*) (buckets + h->bucket_count);
+    size_t next_bucket = 0;
+    for (unsigned i = 0; i < h->location_count; i++) {
+        const Geo_log_checkpoint_location& record = records[i];
+        if (record.bucket_count > h->bucket_count - next_bucket)
+            break;
+        const Geo_log_checkpoint_bucket* traffic = buckets + next_bucket;
+        next_bucket += record.bucket_count;
+        // the entry is looked up again, the database may have changed in the meantime
+        struct in_addr in;
+        in.s_addr = htonl(record.ip_num);
+        Numeric_address addr(in);
+        Geo_ip_entry_ref entry = database->find(addr);
+        if (!entry)
+            continue;
+        Geo_log_data_ref data = create_data(addr, entry);
+        if (!data->restore(record, strings, h->strings_size))
+            continue;
+        for (unsigned j = 0; j < record.bucket_count; j++)
+            data->count(traffic[j].time, traffic[j].count);
+        add_location(record.ip_num, data);
+    }
+    stream_pos = checkpoint_pos = (off_t) h->stream_pos;
+    stream_ino = checkpoint_ino = h->stream_ino;
+    publish();
+    File_observer* observer = get_observer();
+    observer->set_position(stream_pos, stream_ino);
+    clog << "restored " << locations.get_size() << " locations of " << resume_path << " from " << checkpoint_path << endl;
+    if (resume_path != filepath) {
+        observer->tail(resume_path, false);
+        observer->set_position(0, 0);
+    }
+    return true;
+}
+
+Geo_log_snapshot_ref Geo_log_listener::get_snapshot() const
+{
+    Lock::Block lock(snapshot_mutex);
+    return snapshot;
+}
+
+void Geo_log_listener::backfill_rotated(const string& filepath)
+{
+    const IConfig* config = server->get_config();
+    int num_rotated = config->get_parameter("geo-log-rotated", 0);
+    int num_threads = config->get_parameter("geo-log-backfill-threads", (int) std::thread::hardware_concurrency());
+    // logrotate numbers the logs from the newest, the oldest is read first
+    Vector<Geo_log_archive_ref> archives;
+    for (int i = num_rotated; i > 0; i--) {
+        struct stat st;
+        string path = filepath + "." + std::to_string(i);
+        bool compressed = ::stat((path + ".gz").c_str(), &st) == 0;
+        if (compressed)
+            path += ".gz";
+        else if (::stat(path.c_str(), &st) < 0)
+            continue;
+        archives.append(new Geo_log_archive(create_configured_partial(), path, compressed));
+    }
+    size_t group_size = std::max(num_threads, 1);
+    for (size_t i = 0; i < archives.size(); i += group_size) {
+        Vector<Thread*> threads;
+        for (size_t j = i; j < std::min(i + group_size, archives.size()); j++) {
+            Thread* thread = new Thread(static_cast<Geo_log_archive*>(archives[j]));
+            threads.append(thread);
+            thread->start();
+        }
+        for (size_t j = 0; j < threads.size(); j++) {
+            threads[j]->join();
+            delete threads[j];
+        }
+    }
+    if (archives.empty())
+        return;
+    for (size_t i = 0; i < archives.size(); i++)
+        merge(archives[i]->get_locations());
+    publish();
+    clog << "read " << archives.size() << " rotated logs of " << filepath << ", " << locations.get_size() << " locations" << endl;
+}
+
+bool Geo_log_listener::backfill(const string& filepath)
+{
+    IConfig* config = server->get_config();
+    int num_threads = config->get_parameter("geo-log-backfill-threads", (int) std::thread::hardware_concurrency());
+    if (num_threads <= 1)
+        return false;
+    struct stat st;
+    Mapped_file file;
+    if (::stat(filepath.c_str(), &st) < 0 || !file.map(filepath))
+        return false;
+    // an incomplete last line is left to the tail
+    const char* data = (const char*) file.get_data();
+    size_t size = file.get_size();
+    while (size > 0 && data[size - 1] != '\n')
+        size--;
+    size_t num_blocks = std::min((size_t) num_threads, size / min_block_size);
+    if (num_blocks <= 1)
+        return false;
+    Vector<Geo_log_block_ref> blocks;
+    size_t pos = 0;
+    for (size_t i = 0; i < num_blocks && pos < size; i++) {
+        size_t last = i == num_blocks - 1 ? size : std::max(pos, size / num_blocks * (i + 1));
+        const char* eol = last < size ? (const char*) memchr(data + last, '\n', size - last) : 0;
+        size_t next = eol ? eol - data + 1 : size;
+        blocks.append(new Geo_log_block(create_configured_partial(), data + pos, data + next));
+        pos = next;
+    }
+    Vector<Thread*> threads;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        Thread* thread = new Thread(static_cast<Geo_log_block*>(blocks[i]));
+        threads.append(thread);
+        thread->start();
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i]->join();
+        delete threads[i];
+    }
+    for (size_t i = 0; i < blocks.size(); i++)
+        merge(blocks[i]->get_locations());
+    get_observer()->set_position((off_t) size, st.st_ino);
+    set_stream_position((off_t) size, st.st_ino);
+    publish();
+    clog << "backfilled " << locations.get_size() << " locations from " << filepath << " on " << blocks.size() << " threads" << endl;
+    return true;
+}
+
+void Geo_log_listener::merge(const Geo_location_table& partial)
+{
+    changed = true;
+    // the partial table lists its locations least recently seen first
+    for (Geo_location_table::const_iterator it = partial.begin(); it != partial.end(); ++it) {
+        Geo_log_data_ref data;
+        Geo_log_data_ref partial_data = it->second;
+        if (locations.get(it->first, data))
+            data->merge(partial_data);
+        else
+            add_location(it->first, partial_data);
+    }
+}
+
+bool Geo_log_listener::add_location(Geo_ip_num ip_num, Geo_log_data* data)
+{
+    changed = true;
+    bool full = locations.is_full();
+    locations.store(ip_num, data);
+    if (!full)
+        return true;
+    if (locations.contains(ip_num)) {
+        location_evictions.fetch_add(1, memory_order_relaxed);
+        return true;
+    }
+    location_drops.fetch_add(1, memory_order_relaxed);
+    return false;
+}
+
+void Geo_log_listener::output_stats(const string& name, ostream& stream) const
+{
+    Geo_log_snapshot_ref snapshot = get_snapshot();
+    stream << name << "-locations " << snapshot->get_locations().size() << endl;
+    stream << name << "-location-capacity " << locations.get_capacity() << endl;
+    stream << name << "-location-drops " << location_drops.load(memory_order_relaxed) << endl;
+    stream << name << "-location-evictions " << location_evictions.load(memory_order_relaxed) << endl;
 }
 
 //
@@ -127,39 +640,57 @@ void Geo_log_listener::clear_locations()
 //
 
 Geo_access_log_listener::Geo_access_log_listener(Geo_ip_server* server) :
-    Geo_log_listener(server), observer(new File_observer(new Geo_access_log_consumer(this)))
+    Geo_log_listener(server)
 {
+    consumer = new Geo_access_log_consumer(this);
+    observer = new File_observer(consumer);
 }
 
 void Geo_access_log_listener::run()
 {
     IConfig* config = server->get_config();
     const string& log = config->get_parameter("geo-access-log", "/var/log/apache2/access.log");
+    if (!restore(log, "access-log")) {
+        backfill_rotated(log);
+        backfill(log);
+    }
+    int num_cpus = (int) std::thread::hardware_concurrency();
+    start_pipeline("geo-log-pipeline-threads", num_cpus > 1 ? num_cpus : 0);
     observer->tail(log, true);
 }
 
-void Geo_access_log_listener::store(const Address* addr, Geo_ip_entry* entry, const String_vector& columns)
+void Geo_access_log_listener::store(const Numeric_address& addr, const Geo_ip_location& location, const String_slices& columns, time_t time)
 {
-    Geo_locations::const_iterator it = locations.find(addr);
+    unsigned bucket = get_bucket(time ? time : ::time(0));
+    if (is_expired(bucket))
+        return;
+    Geo_log_data_ref known;
     Geo_access_log_data_ref data;
-    if (it == locations.end()) {
-        data = new Geo_access_log_data(addr, entry);
-        add_location(addr, data);
+    if (locations.get(addr.get_ip4_number(), known)) {
+        data = known.cast<Geo_access_log_data>();
     } else {
-        data = it->second.cast<Geo_access_log_data>();
+        // the entry of the location is only created for a new address
+        data = new Geo_access_log_data(addr, location.get_entry());
+        if (!add_location(addr.get_ip4_number(), data))
+            return;
     }
+    changed = true;
     size_t ncols = columns.size();
     if (ncols > 4) {
-        String_vector sv;
-        String_util::split(columns[4], sv);
-        if (sv.size() > 1)
-            data->set_link(sv[1]);
+        // the link is the second word of the request line
+        const String_slice& request = columns[4];
+        size_t pos = request.find(' ');
+        if (pos != string::npos) {
+            size_t end = request.find(' ', pos + 1);
+            data->set_link(request.substr(pos + 1, end == string::npos ? string::npos : end - pos - 1));
+        }
     }
     if (ncols > 7)
         data->set_referer(columns[7]);
     if (ncols > 8)
         data->set_client(columns[8]);
     data->classify(server);
+    data->count(bucket);
 }
 
 //
@@ -167,28 +698,74 @@ void Geo_access_log_listener::store(const Address* addr, Geo_ip_entry* entry, co
 //
 
 Geo_auth_log_listener::Geo_auth_log_listener(Geo_ip_server* server) :
-    Geo_log_listener(server), observer(new File_observer(new Geo_auth_log_consumer(this)))
+    Geo_log_listener(server)
 {
+    consumer = new Geo_auth_log_consumer(this);
+    observer = new File_observer(consumer);
 }
 
 void Geo_auth_log_listener::run()
 {
     IConfig* config = server->get_config();
     const string& log = config->get_parameter("geo-auth-log", "/var/log/auth.log");
+    if (!restore(log, "auth-log")) {
+        backfill_rotated(log);
+        backfill(log);
+    }
+    // the auth log is written far less often, a single resolver keeps up with it
+    start_pipeline("geo-auth-log-pipeline-threads", 1);
     observer->tail(log, true);
 }
 
-void Geo_auth_log_listener::store(const Address* addr, Geo_ip_entry* entry, const String_vector& columns)
+void Geo_auth_log_listener::store(const Numeric_address& addr, const Geo_ip_location& location, const String_slices& columns, time_t time)
 {
-    Geo_locations::const_iterator it = locations.find(addr);
+    unsigned bucket = get_bucket(time ? time : ::time(0));
+    if (is_expired(bucket))
+        return;
+    Geo_log_data_ref known;
     Geo_auth_log_data_ref data;
-    if (it == locations.end()) {
-        data = new Geo_auth_log_data(addr, entry);
-        add_location(addr, data);
+    if (locations.get(addr.get_ip4_number(), known)) {
+        data = known.cast<Geo_auth_log_data>();
     } else {
-        data = it->second.cast<Geo_auth_log_data>();
+        // the entry of the location is only created for a new address
+        data = new Geo_auth_log_data(addr, location.get_entry());
+        if (!add_location(addr.get_ip4_number(), data))
+            return;
     }
+    changed = true;
     data->classify(server);
+    data->count(bucket);
+}
+
+//
+// class Geo_log_block
+//
+
+void Geo_log_block::run()
+{
+    listener->get_observer()->process(begin, end - begin);
+}
+
+void Geo_log_block::fail(const exception& ex)
+{
+    clog << "log backfill failed: " << ex.what() << endl;
+}
+
+//
+// class Geo_log_archive
+//
+
+void Geo_log_archive::run()
+{
+    File_observer* observer = listener->get_observer();
+    bool success = compressed ? observer->process_compressed(filepath) : observer->tail(filepath, false);
+    if (!success)
+        clog << "failed to read " << filepath << endl;
+}
+
+void Geo_log_archive::fail(const exception& ex)
+{
+    clog << "log backfill failed: " << ex.what() << endl;
 }
 
 //
@@ -201,79 +778,107 @@ Geo_log_consumer::Geo_log_consumer(Geo_log_listener* listener) : listener(listen
 
 void Geo_log_consumer::consumer_reset()
 {
-    const Geo_locations& locations = listener->get_locations();
-    clog << "consumer reset: " << locations.size() << endl;
-    listener->clear_locations();
+    // the lines of a rotated log stay counted in their buckets until they expire
+    clog << "consumer reset: " << listener->get_locations().get_size() << endl;
 }
 
-bool Geo_log_consumer::consumer_process(const string& line)
+bool Geo_log_consumer::consumer_process(const String_slice& line)
 {
-    bool success = true;
-    String_vector cols;
-    stringstream sstream(line);
-    do {
-        if (sstream.eof())
-            break;
-        string str;
-        char head = (char) sstream.peek();
-        switch (head) {
-        default:
-            success = process_element(sstream, str);
-            break;
-        case '[':
-            success = process_bracketed(sstream, str);
-            break;
-        case '"':
-            success = process_quoted(sstream, str);
-            break;
-        }
-        String_util::trim(str);
-        cols.append(str);
-    } while (success);
-    consumer_process(cols);
+    Geo_log_pipeline* pipeline = listener->get_pipeline();
+    if (pipeline) {
+        pipeline->push_line(line);
+        return true;
+    }
+    // the columns are reused, so a line is split without allocating
+    tokenize(line, columns);
+    int idx = ip_column(columns);
+    if (idx >= 0)
+        store_column(columns[idx], columns);
     return true;
 }
 
-bool Geo_log_consumer::process_element(istream& stream, string& str)
+void Geo_log_consumer::consumer_flush()
 {
-    getline(stream, str, ' ');
-    return !str.empty();
+    // the lines up to the position of the observer are complete, a checkpoint may refer to it
+    File_observer* observer = listener->get_observer();
+    Geo_log_pipeline* pipeline = listener->get_pipeline();
+    if (pipeline) {
+        pipeline->flush(observer->get_position(), observer->get_inode());
+    } else {
+        listener->set_stream_position(observer->get_position(), observer->get_inode());
+        listener->publish();
+    }
 }
 
-bool Geo_log_consumer::process_bracketed(istream& stream, string& str)
+void Geo_log_consumer::tokenize(const String_slice& line, String_slices& columns)
 {
-    getline(stream, str, ']');
-    if (str.empty())
-        return false;
-    string tmp;
-    getline(stream, tmp, ' ');
-    str += ']';
-    return true;
+    columns.clear();
+    const char* p = line.begin();
+    const char* end = line.end();
+    while (p < end) {
+        if (isspace((unsigned char) *p)) {
+            p++;
+            continue;
+        }
+        const char* e = 0;
+        if (*p == '"') {
+            const char* q = find_quote(p + 1, end);
+            e = q ? q + 1 : end;
+        } else if (*p == '[') {
+            const char* q = (const char*) memchr(p + 1, ']', end - p - 1);
+            e = q ? q + 1 : end;
+        } else {
+            const char* q = (const char*) memchr(p, ' ', end - p);
+            e = q ? q : end;
+        }
+        const char* next = e;
+        while (e > p && isspace((unsigned char) e[-1]))
+            e--;
+        columns.append(String_slice(p, e - p));
+        p = next;
+    }
 }
 
-bool Geo_log_consumer::process_quoted(istream& stream, string& str)
+const char* Geo_log_consumer::find_quote(const char* p, const char* end)
 {
-    stream.get();
-    getline(stream, str, '"');
-    if (str.empty())
-        return false;
-    string tmp;
-    getline(stream, tmp, ' ');
-    str = '"' + str + '"';
-    return true;
+    while (p < end) {
+        const char* q = (const char*) memchr(p, '"', end - p);
+        if (!q)
+            return 0;
+        // skip quotes escaped by an odd number of backslashes
+        const char* b = q;
+        while (b > p && b[-1] == '\\')
+            b--;
+        if ((q - b) % 2 == 0)
+            return q;
+        p = q + 1;
+    }
+    return 0;
 }
 
-bool Geo_log_consumer::store_column(const string& ip, const String_vector& columns)
+bool Geo_log_consumer::resolve(const String_slice& ip, Numeric_address& address)
 {
-    Address_const_ref addr = Address::create_from_dns_name(ip, 0);
-    if (!addr)
+    // numeric columns are parsed in place, only host names are resolved
+    if (!Numeric_address::parse(ip, address) && !Numeric_address::resolve(ip.to_string(), address))
         return false;
-    Geo_ip_server* server = listener->get_server();
-    Geo_ip_file_database* database = server->get_ip_database();
-    Geo_ip_entry_ref entry = database->find(addr);
-    if (!entry)
+    return address.is_ip4();
+}
+
+bool Geo_log_consumer::store_column(const String_slice& ip, const String_slices& columns)
+{
+    Numeric_address addr;
+    if (!resolve(ip, addr))
         return false;
-    listener->store(addr, entry, columns);
+    // known addresses are merely counted, the location is only looked up for a new address and
+    // refers to the database until it is stored
+    Geo_ip_location location;
+    Geo_ip_database_ref database;
+    if (!listener->has_location(addr.get_ip4_number())) {
+        database = listener->get_server()->get_ip_database();
+        if (!database->locate(addr, location))
+            return false;
+    }
+    listener->store(addr, location, columns, log_time(columns));
     return true;
 }
 
@@ -285,14 +890,29 @@ Geo_access_log_consumer::Geo_access_log_consumer(Geo_log_listener* listener) : G
 {
 }
 
-bool Geo_access_log_consumer::consumer_process(const String_vector& columns)
+int Geo_access_log_consumer::ip_column(const String_slices& columns) const
 {
-    size_t ncols = columns.size();
-    if (ncols < 1)
-        return false;
-    const string& ip = columns[0];
-    store_column(ip, columns);
-    return true;
+    return columns.empty() ? -1 : 0;
+}
+
+time_t Geo_access_log_consumer::log_time(const String_slices& columns) const
+{
+    // [18/Oct/2026:06:25:24 +0200]
+    if (columns.size() < 4 || columns[3].length() < 28)
+        return 0;
+    const char* p = columns[3].data();
+    int day = parse_digits(p + 1, 2);
+    int month = parse_month(p + 4);
+    int year = parse_digits(p + 8, 4);
+    int hour = parse_digits(p + 13, 2);
+    int min = parse_digits(p + 16, 2);
+    int sec = parse_digits(p + 19, 2);
+    int zone = parse_digits(p + 23, 4);
+    if (day < 0 || month < 0 || year < 0 || hour < 0 || min < 0 || sec < 0 || zone < 0)
+        return 0;
+    long offset = (zone / 100 * 60 + zone % 100) * 60;
+    time_t time = civil_time(year, month, day, hour, min, sec);
+    return p[22] == '-' ? time + offset : time - offset;
 }
 
 //
@@ -303,27 +923,55 @@ Geo_auth_log_consumer::Geo_auth_log_consumer(Geo_log_listener* listener) : Geo_l
 {
 }
 
-bool Geo_auth_log_consumer::consumer_process(const string& line)
-{
-    return Geo_log_consumer::consumer_process(line);
-}
-
-bool Geo_auth_log_consumer::consumer_process(const String_vector& columns)
+int Geo_auth_log_consumer::ip_column(const String_slices& columns) const
 {
     // report potential break in attempts
     size_t ncols = columns.size();
     if (ncols <= 12)
-        return false;
-    int ip_idx = -1;
+        return -1;
     if (columns[5] == "Failed" && columns[6] == "password")
-        ip_idx = 12;
+        return 12;
     if (columns[5] == "Did" && columns[6] == "not" && columns[7] == "receive" && columns[8] == "identification")
-        ip_idx = 11;
-    if (ip_idx < 0)
-        return false;
-    const string& ip = columns[ip_idx];
-    store_column(ip, columns);
-    return true;
+        return 11;
+    return -1;
+}
+
+time_t Geo_auth_log_consumer::log_time(const String_slices& columns) const
+{
+    return log_time(columns, ::time(0));
+}
+
+time_t Geo_auth_log_consumer::log_time(const String_slices& columns, time_t now) const
+{
+    // Oct 18 06:25:24
+    if (columns.size() < 3 || columns[0].length() != 3 || columns[2].length() != 8)
+        return 0;
+    const String_slice& day_column = columns[1];
+    int month = parse_month(columns[0].data());
+    int day = parse_digits(day_column.data(), (int) day_column.length());
+    const char* p = columns[2].data();
+    int hour = parse_digits(p, 2);
+    int min = parse_digits(p + 3, 2);
+    int sec = parse_digits(p + 6, 2);
+    if (month < 0 || day < 0 || hour < 0 || min < 0 || sec < 0)
+        return 0;
+    struct tm local;
+    ::localtime_r(&now, &local);
+    // a line of december read in january is from the year before, mktime applies the offset of that day
+    for (int year = local.tm_year; year >= local.tm_year - 1; year--) {
+        struct tm tm = {};
+        tm.tm_year = year;
+        tm.tm_mon = month - 1;
+        tm.tm_mday = day;
+        tm.tm_hour = hour;
+        tm.tm_min = min;
+        tm.tm_sec = sec;
+        tm.tm_isdst = -1;
+        time_t time = ::mktime(&tm);
+        if (time != (time_t) -1 && time <= now + 86400)
+            return time;
+    }
+    return 0;
 }
 
 }}
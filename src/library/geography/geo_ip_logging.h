@@ -20,10 +20,85 @@ FORWARD_CLASS(Geo_ip_server);
 FORWARD_CLASS(Geo_log_data);
 FORWARD_CLASS(Geo_access_log_data);
 FORWARD_CLASS(Geo_auth_log_data);
+FORWARD_CLASS(Geo_log_snapshot);
 FORWARD_CLASS(Geo_log_listener);
+FORWARD_CLASS(Geo_log_block);
+FORWARD_CLASS(Geo_log_archive);
 FORWARD_CLASS(Geo_log_consumer);
+FORWARD_CLASS(Geo_auth_log_consumer);
+FORWARD_CLASS(Geo_log_pipeline);
 
-typedef BASE::Hash_map<NET::Address_const_ref,Geo_log_data_ref> Geo_locations;
+typedef BASE::Hash_map<Geo_ip_num,Geo_log_data_ref> Geo_locations;
+typedef BASE::Cache<Geo_ip_num,Geo_log_data_ref> Geo_location_table;
+
+#define GEO_LOG_CHECKPOINT_MAGIC    0x63706967  // "gipc" in host byte order
+#define GEO_LOG_CHECKPOINT_VERSION  1
+
+//
+// Layout of a log checkpoint file
+//
+// The header is followed by the location table, the bucket table and the string table. The buckets of
+// the locations follow each other in the order of the locations, which are listed least recently seen
+// first. Strings are zero terminated and referred to by offset, offset 0 is the empty string.
+//
+
+struct Geo_log_checkpoint_header {
+    unsigned magic;
+    unsigned version;
+    unsigned bucket_seconds;
+    unsigned location_count;
+    unsigned bucket_count;
+    unsigned strings_size;
+    ularge stream_pos;
+    ularge stream_ino;
+};
+
+struct Geo_log_checkpoint_location {
+    Geo_ip_num ip_num;
+    unsigned flags;
+    unsigned bucket_count;
+    unsigned link;
+    unsigned referer;
+    unsigned client;
+};
+
+struct Geo_log_checkpoint_bucket {
+    unsigned time;
+    unsigned count;
+};
+
+//
+// class Geo_traffic
+//
+// The accesses of a location counted in buckets of the log time. Only buckets with accesses are kept,
+// oldest first, so they are counted in constant time and expire from the front.
+//
+
+class Geo_traffic {
+
+public:
+    struct Bucket {
+        unsigned time;
+        unsigned count;
+    };
+
+private:
+    BASE::Vector<Bucket> buckets;
+    size_t first;
+    unsigned total;
+
+public:
+    Geo_traffic() : first(0), total(0) {}
+
+    void add(unsigned time, unsigned count = 1);
+    void merge(const Geo_traffic& traffic);
+    void expire(unsigned oldest);
+    unsigned count_since(unsigned time) const;
+    unsigned get_total() const { return total; }
+    bool is_empty() const { return total == 0; }
+    size_t get_size() const { return buckets.size() - first; }
+    const Bucket& get_bucket(size_t idx) const { return buckets[first + idx]; }
+};
 
 //
 // class Geo_log_data
@@ -31,17 +106,31 @@ typedef BASE::Hash_map<NET::Address_const_ref,Geo_log_data_ref> Geo_locations;
 
 class Geo_log_data : public BASE::Object<> {
 
-    NET::Address_const_ref address;
+    NET::Numeric_address address;
     Geo_ip_entry_const_ref ip_entry;
-    int accesses;
+    Geo_traffic traffic;
+    bool modified;
+
+protected:
+    Geo_log_data(const Geo_log_data& data);
 
 public:
-    Geo_log_data(const NET::Address* address, const Geo_ip_entry* ip_entry);
+    Geo_log_data(const NET::Numeric_address& address, const Geo_ip_entry* ip_entry);
 
+    const NET::Numeric_address& get_address() const { return address; }
     const Geo_ip_entry* get_ip_entry() const { return ip_entry; }
-    void increment_accesses() { accesses++; }
-    int get_accesses() const { return accesses; }
-
+    const Geo_traffic& get_traffic() const { return traffic; }
+    void count(unsigned bucket, unsigned count = 1) { traffic.add(bucket, count); modified = true; }
+    bool expire(unsigned oldest);
+    bool is_modified() const { return modified; }
+    void set_modified(bool state) { modified = state; }
+    int get_accesses() const { return traffic.get_total(); }
+    int get_accesses(unsigned since) const { return since ? traffic.count_since(since) : traffic.get_total(); }
+
+    virtual void merge(const Geo_log_data* data);
+    virtual void save(Geo_log_checkpoint_location& location, std::string& strings) const;
+    virtual bool restore(const Geo_log_checkpoint_location& location, const char* strings, size_t size);
+    virtual Geo_log_data* duplicate() const = 0;
     virtual std::string get_img() const = 0;
     virtual void classify(const Geo_ip_server* server) = 0;
 };
@@ -52,6 +141,10 @@ public:
 
 class Geo_access_log_data : public Geo_log_data {
 
+    static const size_t max_field_length = 256;
+    static const unsigned robot_flag = 1;
+    static const unsigned download_flag = 2;
+
     std::string link;
     std::string referer;
     std::string client;
@@ -60,16 +153,24 @@ class Geo_access_log_data : public Geo_log_data {
 
     void check_link(const BASE::String_vector& sv);
     void check_client(const BASE::String_vector& sv);
+    static void assign(std::string& field, const BASE::String_slice& value);
+    static unsigned save_string(const std::string& field, std::string& strings);
+
+    Geo_access_log_data(const Geo_access_log_data& data);
 
 public:
-    Geo_access_log_data(const NET::Address* address, const Geo_ip_entry* ip_entry);
+    Geo_access_log_data(const NET::Numeric_address& address, const Geo_ip_entry* ip_entry);
 
-    void set_link(const std::string& link) { this->link = link; }
+    void set_link(const BASE::String_slice& link) { assign(this->link, link); }
     const std::string& get_link() const { return link; }
-    void set_referer(const std::string& referer) { this->referer = referer; }
+    void set_referer(const BASE::String_slice& referer) { assign(this->referer, referer); }
     const std::string& get_referer() const { return referer; }
-    void set_client(const std::string& client) { this->client = client; }
+    void set_client(const BASE::String_slice& client) { assign(this->client, client); }
     const std::string& get_client() const { return client; }
+    void merge(const Geo_log_data* data);
+    void save(Geo_log_checkpoint_location& location, std::string& strings) const;
+    bool restore(const Geo_log_checkpoint_location& location, const char* strings, size_t size);
+    Geo_log_data* duplicate() const { return new Geo_access_log_data(*this); }
     std::string get_img() const;
     void classify(const Geo_ip_server* server);
 };
@@ -80,36 +181,124 @@ public:
 
 class Geo_auth_log_data : public Geo_log_data {
 
+    Geo_auth_log_data(const Geo_auth_log_data& data) : Geo_log_data(data) {}
+
 public:
-    Geo_auth_log_data(const NET::Address* address, const Geo_ip_entry* ip_entry);
+    Geo_auth_log_data(const NET::Numeric_address& address, const Geo_ip_entry* ip_entry);
 
+    Geo_log_data* duplicate() const { return new Geo_auth_log_data(*this); }
     std::string get_img() const;
     void classify(const Geo_ip_server* server);
 };
 
+//
+// class Geo_log_snapshot
+//
+// A copy of the locations of a listener, which is not changed after it has been published. Every
+// snapshot has a version of its own, so content rendered from it can be cached by the version. The
+// copies of locations which did not change are shared with the previous snapshot.
+//
+
+class Geo_log_snapshot : public BASE::Object<> {
+
+    friend class Geo_log_listener;
+
+    static std::atomic<unsigned long> next_version;
+
+    Geo_locations locations;
+    int bucket_seconds;
+    unsigned long version;
+
+public:
+    Geo_log_snapshot(int bucket_seconds) : bucket_seconds(bucket_seconds), version(++next_version) {}
+
+    const Geo_locations& get_locations() const { return locations; }
+    unsigned long get_version() const { return version; }
+    unsigned get_bucket(time_t time) const { return (unsigned) (time / bucket_seconds); }
+};
+
 //
 // class Geo_log_listener
 //
+// Before tailing, the rotated logs, compressed or not, are read into partial listeners on their own
+// threads, and a large log is backfilled by splitting it into line aligned blocks which are stored
+// into partial listeners as well. The partial locations are merged oldest first. Then
+// the lines pass a pipeline, or are stored by the reading thread if it has no resolver threads.
+// Only the reading thread or the aggregator of the pipeline change the locations, other threads read
+// the published snapshot. Accesses are counted in buckets of geo-log-bucket-seconds by the time of
+// the log line, locations without accesses in the last geo-log-buckets are dropped when publishing.
+// At most geo-log-locations addresses are tracked, the least recently seen one is evicted for a new
+// one. With geo-log-location-policy=tinylfu, a new address is dropped unless it has been seen more
+// often than the one it would evict. A snapshot is only published when a location changed or the
+// oldest bucket moved on, and only the changed locations are copied into it. Every
+// geo-log-checkpoint-interval seconds the thread storing the locations writes them to a checkpoint
+// together with the position of the log they were read up to, at startup a checkpoint of the same
+// log is restored and the log is read on from that position.
+//
 
 class Geo_log_listener : public BASE::Object<HAL::Runnable> {
 
+    static const size_t min_block_size = 1 << 20;
+    static const size_t default_capacity = 32768;
+
+    mutable HAL::Mutex snapshot_mutex;
+    Geo_log_snapshot_ref snapshot;
+    std::atomic<unsigned long> location_drops;
+    std::atomic<unsigned long> location_evictions;
+    int bucket_seconds;
+    int num_buckets;
+    unsigned oldest_bucket;
+    std::string checkpoint_path;
+    int checkpoint_interval;
+    time_t checkpoint_time;
+    off_t checkpoint_pos;
+    ularge checkpoint_ino;
+    off_t stream_pos;
+    ularge stream_ino;
+
+    unsigned get_oldest_bucket(time_t now) const;
+    bool checkpoint();
+
 protected:
     Geo_ip_server_weak_ref server;
-    Geo_locations locations;
+    Geo_log_consumer_ref consumer;
+    Geo_log_pipeline_ref pipeline;
+    Geo_location_table locations;
+    bool changed;
     bool done;
 
+    Geo_log_listener* create_configured_partial();
+    bool restore(const std::string& filepath, const std::string& name);
+    void backfill_rotated(const std::string& filepath);
+    bool backfill(const std::string& filepath);
+    void merge(const Geo_location_table& partial);
+    void start_pipeline(const std::string& key, int default_threads);
+
 public:
     Geo_log_listener(Geo_ip_server* server);
 
+    void configure(const BASE::IConfig* config);
     Geo_ip_server* get_server() { return server; }
+    Geo_log_consumer* get_consumer() { return consumer; }
+    Geo_log_pipeline* get_pipeline() { return pipeline; }
     void run();
     void fail(const std::exception& ex);
     void stop();
-    void add_location(const NET::Address* ip, Geo_log_data* data);
-    const Geo_locations& get_locations() const { return locations; }
-    void clear_locations();
-
-    virtual void store(const NET::Address* addr, Geo_ip_entry* entry, const BASE::String_vector& columns) = 0;
+    bool add_location(Geo_ip_num ip_num, Geo_log_data* data);
+    const Geo_location_table& get_locations() const { return locations; }
+    bool has_location(Geo_ip_num ip_num) const { return locations.contains(ip_num); }
+    unsigned get_bucket(time_t time) const { return (unsigned) (time / bucket_seconds); }
+    bool is_expired(unsigned bucket) const { return bucket < oldest_bucket; }
+    void set_stream_position(off_t pos, ularge ino) { stream_pos = pos; stream_ino = ino; }
+    void set_checkpoint(const std::string& path, int interval) { checkpoint_path = path; checkpoint_interval = interval; }
+    bool restore_checkpoint(const std::string& filepath, const Geo_ip_database* database);
+    void publish();
+    Geo_log_snapshot_ref get_snapshot() const;
+    void output_stats(const std::string& name, std::ostream& stream) const;
+
+    virtual void store(const NET::Numeric_address& addr, const Geo_ip_location& location, const BASE::String_slices& columns, time_t time) = 0;
+    virtual Geo_log_listener* create_partial() = 0;
+    virtual Geo_log_data* create_data(const NET::Numeric_address& addr, const Geo_ip_entry* entry) const = 0;
     virtual UTIL::File_observer* get_observer() = 0;
 };
 
@@ -125,7 +314,9 @@ public:
     Geo_access_log_listener(Geo_ip_server* server);
 
     UTIL::File_observer* get_observer() { return observer; }
-    void store(const NET::Address* addr, Geo_ip_entry* entry, const BASE::String_vector& columns);
+    void store(const NET::Numeric_address& addr, const Geo_ip_location& location, const BASE::String_slices& columns, time_t time);
+    Geo_log_listener* create_partial() { return new Geo_access_log_listener(server); }
+    Geo_log_data* create_data(const NET::Numeric_address& addr, const Geo_ip_entry* entry) const { return new Geo_access_log_data(addr, entry); }
     void run();
 };
 
@@ -141,31 +332,84 @@ public:
     Geo_auth_log_listener(Geo_ip_server* server);
 
     UTIL::File_observer* get_observer() { return observer; }
-    void store(const NET::Address* addr, Geo_ip_entry* entry, const BASE::String_vector& columns);
+    void store(const NET::Numeric_address& addr, const Geo_ip_location& location, const BASE::String_slices& columns, time_t time);
+    Geo_log_listener* create_partial() { return new Geo_auth_log_listener(server); }
+    Geo_log_data* create_data(const NET::Numeric_address& addr, const Geo_ip_entry* entry) const { return new Geo_auth_log_data(addr, entry); }
+    void run();
+};
+
+//
+// class Geo_log_block
+//
+// A line aligned part of a log, stored into a partial listener on its own thread.
+//
+
+class Geo_log_block : public BASE::Object<HAL::Runnable> {
+
+    Geo_log_listener_ref listener;
+    const char* begin;
+    const char* end;
+
+public:
+    Geo_log_block(Geo_log_listener* listener, const char* begin, const char* end) :
+        listener(listener), begin(begin), end(end) {}
+
+    const Geo_location_table& get_locations() const { return listener->get_locations(); }
+    void run();
+    void fail(const std::exception& ex);
+};
+
+//
+// class Geo_log_archive
+//
+// A rotated log, stored into a partial listener on its own thread.
+//
+
+class Geo_log_archive : public BASE::Object<HAL::Runnable> {
+
+    Geo_log_listener_ref listener;
+    std::string filepath;
+    bool compressed;
+
+public:
+    Geo_log_archive(Geo_log_listener* listener, const std::string& filepath, bool compressed) :
+        listener(listener), filepath(filepath), compressed(compressed) {}
+
+    const Geo_location_table& get_locations() const { return listener->get_locations(); }
     void run();
+    void fail(const std::exception& ex);
 };
 
 //
 // class Geo_log_consumer
 //
+// Log lines are split into slices of the line, quoted and bracketed columns keep their delimiters.
+// The time of a line is parsed from its columns, 0 stands for a line without a valid time.
+//
 
 class Geo_log_consumer : public BASE::Object<UTIL::IFile_consumer> {
 
-    bool process_element(std::istream& stream, std::string& str);
-    bool process_bracketed(std::istream& stream, std::string& str);
-    bool process_quoted(std::istream& stream, std::string& str);
+    BASE::String_slices columns;
+
+    static const char* find_quote(const char* p, const char* end);
 
 protected:
     Geo_log_listener_weak_ref listener;
 
     Geo_log_consumer(Geo_log_listener* listener);
 
-    bool store_column(const std::string& ip, const BASE::String_vector& columns);
-
-    virtual bool consumer_process(const std::string& line);
-    virtual bool consumer_process(const BASE::String_vector& cols) = 0;
+    bool store_column(const BASE::String_slice& ip, const BASE::String_slices& columns);
 
+    bool consumer_process(const BASE::String_slice& line);
     void consumer_reset();
+    void consumer_flush();
+
+public:
+    virtual int ip_column(const BASE::String_slices& cols) const = 0;
+    virtual time_t log_time(const BASE::String_slices& cols) const = 0;
+
+    static void tokenize(const BASE::String_slice& line, BASE::String_slices& columns);
+    static bool resolve(const BASE::String_slice& ip, NET::Numeric_address& address);
 };
 
 //
@@ -174,25 +418,28 @@ protected:
 
 class Geo_access_log_consumer : public Geo_log_consumer {
 
-protected:
-    bool consumer_process(const BASE::String_vector& cols);
-
 public:
     Geo_access_log_consumer(Geo_log_listener* listener);
+
+    int ip_column(const BASE::String_slices& cols) const;
+    time_t log_time(const BASE::String_slices& cols) const;
 };
 
 //
 // class Geo_auth_log_consumer
 //
+// Syslog writes the local time without the year. Each line is taken from the current or the previous year,
+// whichever is closest to now without being more than a day ahead.
+//
 
 class Geo_auth_log_consumer : public Geo_log_consumer {
 
-protected:
-    bool consumer_process(const std::string& line);
-    bool consumer_process(const BASE::String_vector& cols);
-
 public:
     Geo_auth_log_consumer(Geo_log_listener* listener);
+
+    int ip_column(const BASE::String_slices& cols) const;
+    time_t log_time(const BASE::String_slices& cols) const;
+    time_t log_time(const BASE::String_slices& cols, time_t now) const;
 };
 
 }}
@@ -0,0 +1,279 @@
+//
+//  geo_ip_pipeline.cpp
+//
+//  Created by Christian Lehner on 18/10/26.
+//  Copyright (c) 2019 Softhub. All rights reserved.
+//
+
+#include "stdafx.h"
+#include "geo_ip_pipeline.h"
+#include "geo_ip_server.h"
+
+using namespace SOFTHUB::BASE;
+using namespace SOFTHUB::HAL;
+using namespace SOFTHUB::NET;
+using namespace SOFTHUB::UTIL;
+using namespace std;
+
+namespace SOFTHUB {
+namespace GEOGRAPHY {
+
+//
+// class Geo_log_pipeline
+//
+
+Geo_log_pipeline::Geo_log_pipeline(Geo_log_listener* listener, int num_resolvers) :
+    listener(listener), pending(0), sequence(0), positioned(false), input(queue_size), stopped(false),
+    parked_resolvers(0), parked_aggregators(0), lines_read(0), lines_resolved(0), lines_stored(0),
+    reader_stalls(0), resolver_stalls(0), snapshots(0)
+{
+    for (int i = 0; i < std::max(num_resolvers, 1); i++)
+        outputs.append(new Output_queue(queue_size));
+}
+
+Geo_log_pipeline::~Geo_log_pipeline()
+{
+    stop();
+    delete pending;
+    Geo_log_batch* batch;
+    while (input.pop(batch))
+        delete batch;
+    for (size_t i = 0; i < outputs.size(); i++) {
+        while (outputs[i]->pop(batch))
+            delete batch;
+        delete outputs[i];
+    }
+}
+
+void Geo_log_pipeline::start()
+{
+    for (size_t i = 0; i <= outputs.size(); i++) {
+        // the last stage is the aggregator
+        int resolver = i < outputs.size() ? (int) i : -1;
+        Thread* thread = new Thread(new Geo_log_stage(this, resolver));
+        threads.append(thread);
+        thread->start();
+    }
+}
+
+void Geo_log_pipeline::stop()
+{
+    if (stopped.exchange(true))
+        return;
+    {
+        Lock::Block lock(park_mutex);
+        for (size_t i = 0; i < threads.size(); i++) {
+            resolver_condition.signal();
+            aggregator_condition.signal();
+        }
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i]->join();
+        delete threads[i];
+    }
+    threads.clear();
+}
+
+void Geo_log_pipeline::push_line(const String_slice& line)
+{
+    if (!pending)
+        pending = new Geo_log_batch(sequence++);
+    pending->text.append(line.data(), line.length());
+    pending->text += '\n';
+    pending->lines++;
+    if (pending->text.length() >= batch_size)
+        flush();
+}
+
+void Geo_log_pipeline::flush()
+{
+    if (!pending)
+        return;
+    Geo_log_batch* batch = pending;
+    pending = 0;
+    positioned = batch->position >= 0;
+    submit(batch);
+}
+
+void Geo_log_pipeline::flush(off_t position, ularge inode)
+{
+    // without lines since the last positioned batch the aggregator already knows the position
+    if (!pending) {
+        if (positioned)
+            return;
+        pending = new Geo_log_batch(sequence++);
+    }
+    pending->position = position;
+    pending->inode = inode;
+    flush();
+}
+
+void Geo_log_pipeline::submit(Geo_log_batch* batch)
+{
+    lines_read.fetch_add(batch->lines, memory_order_relaxed);
+    while (!input.push(batch)) {
+        if (stopped.load()) {
+            delete batch;
+            return;
+        }
+        reader_stalls.fetch_add(1, memory_order_relaxed);
+        Thread::sleep(1);
+    }
+    wake(parked_resolvers, resolver_condition);
+}
+
+void Geo_log_pipeline::wake(atomic<int>& parked, Condition& condition)
+{
+    // the push must be visible before the parked count is read, a stage about to park checks its queue
+    atomic_thread_fence(memory_order_seq_cst);
+    if (parked.load() > 0) {
+        Lock::Block lock(park_mutex);
+        condition.signal();
+    }
+}
+
+void Geo_log_pipeline::resolve(Geo_log_batch* batch, String_slices& columns)
+{
+    Geo_log_consumer* consumer = listener->get_consumer();
+    Geo_ip_database_ref database = listener->get_server()->get_ip_database();
+    batch->database = database;
+    const char* p = batch->text.data();
+    const char* end = p + batch->text.length();
+    while (p < end) {
+        const char* eol = (const char*) memchr(p, '\n', end - p);
+        String_slice line(p, eol - p);
+        p = eol + 1;
+        Geo_log_consumer::tokenize(line, columns);
+        int idx = consumer->ip_column(columns);
+        Geo_log_record record;
+        if (idx < 0 || !Geo_log_consumer::resolve(columns[idx], record.address))
+            continue;
+        if (!database->locate(record.address, record.location))
+            continue;
+        record.time = consumer->log_time(columns);
+        record.first_column = batch->columns.size();
+        record.num_columns = columns.size();
+        for (size_t i = 0; i < columns.size(); i++)
+            batch->columns.append(columns[i]);
+        batch->records.append(record);
+    }
+    lines_resolved.fetch_add(batch->records.size(), memory_order_relaxed);
+}
+
+void Geo_log_pipeline::aggregate(Geo_log_batch* batch, String_slices& columns)
+{
+    for (size_t i = 0, n = batch->records.size(); i < n; i++) {
+        Geo_log_record& record = batch->records[i];
+        columns.clear();
+        for (size_t j = 0; j < record.num_columns; j++)
+            columns.append(batch->columns[record.first_column + j]);
+        listener->store(record.address, record.location, columns, record.time);
+    }
+    // a batch ended within a chunk has no position, the one of the last positioned batch stays
+    if (batch->position >= 0)
+        listener->set_stream_position(batch->position, batch->inode);
+    lines_stored.fetch_add(batch->records.size(), memory_order_relaxed);
+}
+
+bool Geo_log_pipeline::has_next(size_t next) const
+{
+    for (size_t i = 0; i < outputs.size(); i++) {
+        Geo_log_batch* const* batch = outputs[i]->front();
+        if (batch && (*batch)->sequence == next)
+            return true;
+    }
+    return false;
+}
+
+void Geo_log_pipeline::run_resolver(size_t idx)
+{
+    Output_queue* output = outputs[idx];
+    String_slices columns;
+    while (!stopped.load()) {
+        Geo_log_batch* batch;
+        if (!input.pop(batch)) {
+            Lock::Block lock(park_mutex);
+            parked_resolvers++;
+            if (input.is_empty() && !stopped.load())
+                resolver_condition.wait(park_mutex);
+            parked_resolvers--;
+            continue;
+        }
+        resolve(batch, columns);
+        while (!output->push(batch)) {
+            if (stopped.load()) {
+                delete batch;
+                return;
+            }
+            resolver_stalls.fetch_add(1, memory_order_relaxed);
+            Thread::sleep(1);
+        }
+        wake(parked_aggregators, aggregator_condition);
+    }
+}
+
+void Geo_log_pipeline::run_aggregator()
+{
+    size_t next = 0;
+    bool dirty = false;
+    long long published = Timer_wheel::now();
+    String_slices columns;
+    while (!stopped.load()) {
+        bool progress = false;
+        for (size_t i = 0; i < outputs.size(); i++) {
+            Geo_log_batch* const* front;
+            while ((front = outputs[i]->front()) && (*front)->sequence == next) {
+                Geo_log_batch* batch;
+                outputs[i]->pop(batch);
+                aggregate(batch, columns);
+                delete batch;
+                next++;
+                progress = dirty = true;
+            }
+        }
+        long long now = Timer_wheel::now();
+        // the http side reads the last snapshot, it is renewed when idle or after an interval
+        if (dirty && (!progress || now - published >= publish_interval)) {
+            listener->publish();
+            snapshots.fetch_add(1, memory_order_relaxed);
+            published = now;
+            dirty = false;
+        }
+        if (!progress) {
+            Lock::Block lock(park_mutex);
+            parked_aggregators++;
+            if (!has_next(next) && !stopped.load())
+                aggregator_condition.wait(park_mutex);
+            parked_aggregators--;
+        }
+    }
+}
+
+void Geo_log_pipeline::output_stats(const string& name, ostream& stream) const
+{
+    stream << name << "-lines-read " << lines_read.load(memory_order_relaxed) << endl;
+    stream << name << "-lines-resolved " << lines_resolved.load(memory_order_relaxed) << endl;
+    stream << name << "-lines-stored " << lines_stored.load(memory_order_relaxed) << endl;
+    stream << name << "-reader-stalls " << reader_stalls.load(memory_order_relaxed) << endl;
+    stream << name << "-resolver-stalls " << resolver_stalls.load(memory_order_relaxed) << endl;
+    stream << name << "-snapshots " << snapshots.load(memory_order_relaxed) << endl;
+}
+
+//
+// class Geo_log_stage
+//
+
+void Geo_log_stage::run()
+{
+    if (resolver >= 0)
+        pipeline->run_resolver(resolver);
+    else
+        pipeline->run_aggregator();
+}
+
+void Geo_log_stage::fail(const exception& ex)
+{
+    clog << "log pipeline failed: " << ex.what() << endl;
+}
+
+}}
@@ -0,0 +1,131 @@
+//
+//  geo_ip_pipeline.h
+//
+//  Created by Christian Lehner on 18/10/26.
+//  Copyright (c) 2019 Softhub. All rights reserved.
+//
+
+#ifndef SOFTHUB_LIB_GEOGRAPHY_PIPELINE_H
+#define SOFTHUB_LIB_GEOGRAPHY_PIPELINE_H
+
+#include "geo_ip_logging.h"
+
+namespace SOFTHUB {
+namespace GEOGRAPHY {
+
+FORWARD_CLASS(Geo_log_stage);
+
+//
+// struct Geo_log_record
+//
+
+struct Geo_log_record {
+    NET::Numeric_address address;
+    Geo_ip_location location;
+    time_t time;
+    size_t first_column;
+    size_t num_columns;
+};
+
+//
+// class Geo_log_batch
+//
+// Complete lines copied by the reader. A resolver adds a record for each line with a location, the
+// columns of the records refer to the text of the batch, their locations to the database the batch
+// keeps. The last batch before the reader waits for the log carries the position of the log after
+// its lines, the others a position of -1.
+//
+
+class Geo_log_batch {
+
+public:
+    size_t sequence;
+    size_t lines;
+    off_t position;
+    ularge inode;
+    std::string text;
+    BASE::String_slices columns;
+    BASE::Vector<Geo_log_record> records;
+    Geo_ip_database_ref database;
+
+    Geo_log_batch(size_t sequence) : sequence(sequence), lines(0), position(-1), inode(0) {}
+};
+
+//
+// class Geo_log_pipeline
+//
+// Lines of a log pass from the reader to a number of resolver threads, which tokenize them and look
+// up their location, and from there to a single aggregator thread, which alone stores into the
+// locations of the listener. Each resolver hands its batches to the aggregator in a queue of its own,
+// the aggregator takes them in the order they were read. Full queues make the stage in front wait.
+//
+
+class Geo_log_pipeline : public BASE::Object<> {
+
+    friend class Geo_log_stage;
+
+    static const size_t batch_size = 1 << 16;
+    static const size_t queue_size = 64;
+    static const int publish_interval = 1000;
+
+    typedef BASE::Spsc_queue<Geo_log_batch*> Output_queue;
+
+    Geo_log_listener_weak_ref listener;
+    Geo_log_batch* pending;
+    size_t sequence;
+    bool positioned;
+    BASE::Mpmc_queue<Geo_log_batch*> input;
+    BASE::Vector<Output_queue*> outputs;
+    BASE::Vector<HAL::Thread*> threads;
+    std::atomic<bool> stopped;
+    HAL::Mutex park_mutex;
+    HAL::Condition resolver_condition;
+    HAL::Condition aggregator_condition;
+    std::atomic<int> parked_resolvers;
+    std::atomic<int> parked_aggregators;
+    std::atomic<unsigned long> lines_read;
+    std::atomic<unsigned long> lines_resolved;
+    std::atomic<unsigned long> lines_stored;
+    std::atomic<unsigned long> reader_stalls;
+    std::atomic<unsigned long> resolver_stalls;
+    std::atomic<unsigned long> snapshots;
+
+    void submit(Geo_log_batch* batch);
+    void resolve(Geo_log_batch* batch, BASE::String_slices& columns);
+    void aggregate(Geo_log_batch* batch, BASE::String_slices& columns);
+    bool has_next(size_t next) const;
+    void run_resolver(size_t idx);
+    void run_aggregator();
+    void wake(std::atomic<int>& parked, HAL::Condition& condition);
+
+public:
+    Geo_log_pipeline(Geo_log_listener* listener, int num_resolvers);
+    ~Geo_log_pipeline();
+
+    void start();
+    void stop();
+    void push_line(const BASE::String_slice& line);
+    void flush();
+    void flush(off_t position, ularge inode);
+    void output_stats(const std::string& name, std::ostream& stream) const;
+};
+
+//
+// class Geo_log_stage
+//
+
+class Geo_log_stage : public BASE::Object<HAL::Runnable> {
+
+    Geo_log_pipeline* pipeline;
+    int resolver;
+
+public:
+    Geo_log_stage(Geo_log_pipeline* pipeline, int resolver) : pipeline(pipeline), resolver(resolver) {}
+
+    void run();
+    void fail(const std::exception& ex);
+};
+
+}}
+
+#endif
@@ -13,6 +13,7 @@
 #include <net/net.h>
 #include <util/util.h>
 #include <fstream>
+#include <thread>
 
 using namespace SOFTHUB::BASE;
 using namespace SOFTHUB::HAL;
@@ -202,4 +203,373 @@ void Geo_ip_deserializer::read(Geo_ip_entry*& obj)
     obj->deserialize(this);
 }
 
+//
+// class Geo_ip_index_writer
+//
+
+Geo_ip_index_writer::Geo_ip_index_writer(const string& filename) : filename(filename)
+{
+    append_string("");
+}
+
+unsigned Geo_ip_index_writer::append_string(const String_slice& s)
+{
+    const string& key = s.to_string();
+    Hash_map<string,unsigned>::const_iterator it = string_offsets.find(key);
+    if (it != string_offsets.end())
+        return it->second;
+    unsigned offset = (unsigned) strings.size();
+    strings.append(key.c_str(), key.length() + 1);
+    string_offsets.insert(key, offset);
+    return offset;
+}
+
+unsigned Geo_ip_index_writer::append_record(const Geo_ip_index_record& record)
+{
+    const string key((const char*) &record, sizeof(record));
+    Hash_map<string,unsigned>::const_iterator it = record_indices.find(key);
+    if (it != record_indices.end())
+        return it->second;
+    unsigned idx = (unsigned) records.size();
+    records.append(record);
+    record_indices.insert(key, idx);
+    return idx;
+}
+
+unsigned Geo_ip_index_writer::append_record(const Geo_ip_entry* entry)
+{
+    const Geo_coordinates& coords = entry->get_coordinates();
+    Geo_ip_index_record record;
+    record.country_code = append_string(entry->get_country_code());
+    record.country = append_string(entry->get_country());
+    record.state = append_string(entry->get_state());
+    record.city = append_string(entry->get_city());
+    record.zip = append_string(entry->get_zip());
+    record.tz = append_string(entry->get_tz());
+    record.latitude = coords.get_latitude().to_degrees<float>();
+    record.longitude = coords.get_longitude().to_degrees<float>();
+    return append_record(record);
+}
+
+void Geo_ip_index_writer::append(const Geo_ip_entry* entry)
+{
+    const Geo_ip_range& range = entry->get_range();
+    Geo_ip_index_range index_range;
+    index_range.lo = range.get_lower();
+    index_range.hi = range.get_upper();
+    index_range.record = append_record(entry);
+    ranges.append(index_range);
+}
+
+void Geo_ip_index_writer::append(const Geo_ip_data* data)
+{
+    for (size_t i = 0, n = data->get_size(); i < n; i++)
+        append((*data)[i]);
+}
+
+void Geo_ip_index_writer::append(const Geo_ip_csv_row& row)
+{
+    Geo_ip_index_record record;
+    record.country_code = append_string(row.country_code);
+    record.country = append_string(row.country);
+    record.state = append_string(row.state);
+    record.city = append_string(row.city);
+    record.zip = append_string(row.zip);
+    record.tz = append_string(row.tz);
+    record.latitude = (float) row.latitude;
+    record.longitude = (float) row.longitude;
+    Geo_ip_index_range index_range;
+    index_range.lo = row.lo;
+    index_range.hi = row.hi;
+    index_range.record = append_record(record);
+    ranges.append(index_range);
+}
+
+int Geo_ip_index_writer::write()
+{
+    std::sort(ranges.begin(), ranges.end(), [](const Geo_ip_index_range& a, const Geo_ip_index_range& b) {
+        return a.lo < b.lo;
+    });
+    Geo_ip_index_header header;
+    header.magic = GEO_IP_INDEX_MAGIC;
+    header.version = GEO_IP_INDEX_VERSION;
+    header.range_count = (unsigned) ranges.size();
+    header.record_count = (unsigned) records.size();
+    header.ranges_offset = sizeof(header);
+    header.records_offset = header.ranges_offset + header.range_count * sizeof(Geo_ip_index_range);
+    header.strings_offset = header.records_offset + header.record_count * sizeof(Geo_ip_index_record);
+    header.strings_size = (unsigned) strings.size();
+    const string& tmp_filename = filename + ".tmp";
+    FILE* file = fopen(tmp_filename.c_str(), "wb");
+    if (!file)
+        return -1;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && (ranges.empty() || fwrite(ranges.data(), sizeof(Geo_ip_index_range), ranges.size(), file) == ranges.size());
+    ok = ok && (records.empty() || fwrite(records.data(), sizeof(Geo_ip_index_record), records.size(), file) == records.size());
+    ok = ok && fwrite(strings.data(), 1, strings.size(), file) == strings.size();
+    if (fclose(file) != 0)
+        ok = false;
+    if (!ok) {
+        File_path::remove_file(tmp_filename);
+        return -2;
+    }
+    if (!File_path::rename_file(tmp_filename, filename))
+        return -3;
+    clog << "wrote " << header.range_count << " ranges, " << header.record_count << " records to " << filename << endl;
+    return 0;
+}
+
+//
+// class Geo_ip_csv_block
+//
+
+static Mutex coordinate_parser_mutex;
+
+static String_slice trim_slice(const String_slice& s)
+{
+    const char* b = s.begin();
+    const char* e = s.end();
+    while (b < e && isspace((unsigned char) *b))
+        b++;
+    while (e > b && isspace((unsigned char) e[-1]))
+        e--;
+    return String_slice(b, e - b);
+}
+
+Geo_ip_csv_block::Geo_ip_csv_block(const char* begin, const char* end, atomic<size_t>* progress) :
+    begin(begin), end(end), progress(progress), errors(0), finished(false), failed(false)
+{
+}
+
+const char* Geo_ip_csv_block::next_column(const char* p, const char* eol, String_slice& column)
+{
+    while (p < eol && (*p == ' ' || *p == '\t'))
+        p++;
+    if (p < eol && *p == '"') {
+        const char* start = ++p;
+        bool escaped = false;
+        while (p < eol) {
+            if (*p == '"') {
+                if (p + 1 == eol || p[1] != '"')
+                    break;
+                escaped = true;
+                p++;
+            }
+            p++;
+        }
+        column = String_slice(start, p - start);
+        if (escaped) {
+            string s;
+            for (const char* q = start; q < p; q++) {
+                s += *q;
+                if (*q == '"')
+                    q++;
+            }
+            unescaped.push_back(s);
+            column = unescaped.back();
+        }
+    } else {
+        const char* start = p;
+        while (p < eol && *p != ',')
+            p++;
+        column = String_slice(start, p - start);
+    }
+    column = trim_slice(column);
+    while (p < eol && *p != ',')
+        p++;
+    return p < eol ? p + 1 : p;
+}
+
+bool Geo_ip_csv_block::parse_ip(const String_slice& s, Geo_ip_num& ip)
+{
+    unsigned long long part = 0, value = 0;
+    int dots = 0;
+    bool digits = false;
+    for (size_t i = 0, n = s.length(); i < n; i++) {
+        char c = s[i];
+        if (c >= '0' && c <= '9') {
+            part = part * 10 + (c - '0');
+            if (part > 0xffffffffULL)
+                return false;
+            digits = true;
+        } else if (c == '.' && digits && part <= 255 && ++dots <= 3) {
+            value = (value << 8) | part;
+            part = 0;
+            digits = false;
+        } else {
+            return false;
+        }
+    }
+    if (!digits)
+        return false;
+    if (dots == 0)
+        ip = (Geo_ip_num) part;
+    else if (dots == 3 && part <= 255)
+        ip = (Geo_ip_num) ((value << 8) | part);
+    else
+        return false;
+    return true;
+}
+
+bool Geo_ip_csv_block::parse_degrees(const String_slice& s, double& degrees)
+{
+    char buf[64];
+    size_t len = s.length();
+    if (len == 0 || len >= sizeof(buf))
+        return false;
+    memcpy(buf, s.data(), len);
+    buf[len] = '\0';
+    char* tail;
+    degrees = strtod(buf, &tail);
+    return tail == buf + len;
+}
+
+bool Geo_ip_csv_block::parse_line(const char* p, const char* eol, Geo_ip_csv_row& row)
+{
+    String_slice ip_from, ip_to, lat, lon;
+    p = next_column(p, eol, ip_from);
+    p = next_column(p, eol, ip_to);
+    p = next_column(p, eol, row.country_code);
+    p = next_column(p, eol, row.country);
+    p = next_column(p, eol, row.state);
+    p = next_column(p, eol, row.city);
+    p = next_column(p, eol, lat);
+    p = next_column(p, eol, lon);
+    p = next_column(p, eol, row.zip);
+    p = next_column(p, eol, row.tz);
+    if (!parse_ip(ip_from, row.lo) || !parse_ip(ip_to, row.hi))
+        return false;
+    if (parse_degrees(lat, row.latitude) && parse_degrees(lon, row.longitude))
+        return true;
+#ifndef NO_GEO_PARSER
+    // the coordinate parser keeps its result in globals
+    Lock::Block lock(coordinate_parser_mutex);
+    row.latitude = Geo_latitude::parse(lat.to_string()).to_degrees<double>();
+    row.longitude = Geo_longitude::parse(lon.to_string()).to_degrees<double>();
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Geo_ip_csv_block::run()
+{
+    try {
+        tokenize();
+    } catch (std::exception& ex) {
+        failed = true;
+        fail(ex);
+    }
+    finished.store(true, memory_order_release);
+}
+
+void Geo_ip_csv_block::tokenize()
+{
+    const size_t progress_step = 1 << 20;
+    const char* p = begin;
+    const char* reported = begin;
+    while (p < end) {
+        const char* eol = (const char*) memchr(p, '\n', end - p);
+        const char* next = eol ? eol + 1 : end;
+        if (!eol)
+            eol = end;
+        if (eol > p && eol[-1] == '\r')
+            eol--;
+        if (trim_slice(String_slice(p, eol - p)).length() > 0) {
+            Geo_ip_csv_row row;
+            if (parse_line(p, eol, row))
+                rows.append(row);
+            else
+                errors++;
+        }
+        p = next;
+        if (size_t(p - reported) >= progress_step) {
+            progress->fetch_add(p - reported, memory_order_relaxed);
+            reported = p;
+        }
+    }
+    progress->fetch_add(end - reported, memory_order_release);
+}
+
+void Geo_ip_csv_block::fail(const exception& ex)
+{
+    clog << "csv import failed: " << ex.what() << endl;
+}
+
+//
+// class Geo_ip_csv_importer
+//
+
+Geo_ip_csv_importer::Geo_ip_csv_importer(int num_threads) : progress(0), num_threads(num_threads)
+{
+    if (this->num_threads <= 0)
+        this->num_threads = std::max(1, (int) std::thread::hardware_concurrency());
+}
+
+int Geo_ip_csv_importer::import(const string& filename)
+{
+    if (!file.map(filename))
+        return -1;
+    const char* data = (const char*) file.get_data();
+    const size_t size = file.get_size();
+    const size_t min_block_size = 1 << 20;
+    size_t num_blocks = std::max((size_t) 1, std::min((size_t) num_threads, size / min_block_size));
+    blocks.clear();
+    progress = 0;
+    size_t pos = 0;
+    for (size_t i = 0; i < num_blocks && pos < size; i++) {
+        size_t last = i == num_blocks - 1 ? size : std::max(pos, size / num_blocks * (i + 1));
+        const char* eol = last < size ? (const char*) memchr(data + last, '\n', size - last) : 0;
+        size_t next = eol ? eol - data + 1 : size;
+        blocks.append(new Geo_ip_csv_block(data + pos, data + next, &progress));
+        pos = next;
+    }
+    Vector<Thread*> threads;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        Thread* thread = new Thread(static_cast<Geo_ip_csv_block*>(blocks[i]));
+        threads.append(thread);
+        thread->start();
+    }
+    // the progress is only reported, a failed block does not account for all of its bytes
+    int percent = 0;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        while (!blocks[i]->is_finished()) {
+            report_progress(percent);
+            Thread::sleep(100);
+        }
+    }
+    report_progress(percent);
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i]->join();
+        delete threads[i];
+    }
+    int errors = 0;
+    bool failed = false;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        errors += blocks[i]->get_errors();
+        failed = failed || blocks[i]->has_failed();
+    }
+    if (errors > 0)
+        clog << "skipped " << errors << " malformed lines in " << filename << endl;
+    return failed ? -1 : 0;
+}
+
+void Geo_ip_csv_importer::report_progress(int& percent) const
+{
+    size_t size = file.get_size();
+    int current = size ? (int) (progress.load(memory_order_relaxed) * 100 / size) : 100;
+    if (current / 10 > percent / 10) {
+        clog << "imported " << current << "%" << endl;
+        percent = current;
+    }
+}
+
+size_t Geo_ip_csv_importer::get_row_count() const
+{
+    size_t count = 0;
+    for (size_t i = 0; i < blocks.size(); i++)
+        count += blocks[i]->get_rows().size();
+    return count;
+}
+
 }}
@@ -13,6 +13,7 @@
 #include "geo_ip.h"
 #include <net/net.h>
 #include <util/util.h>
+#include <list>
 
 #ifdef PLATFORM_MAC
 #define DEFAULT_DATA "../.."
@@ -27,6 +28,7 @@ class Geo_ip_range;
 
 FORWARD_CLASS(Geo_ip_entry);
 FORWARD_CLASS(Geo_ip_database);
+FORWARD_CLASS(Geo_ip_csv_block);
 DECLARE_ARRAY(Geo_ip_entry_ref, Geo_ip_data);
 
 //
@@ -130,6 +132,124 @@ public:
     void read(Geo_ip_entry*& entry);
 };
 
+//
+// struct Geo_ip_csv_row
+//
+// One line of the ip csv. The strings refer into the mapped csv file or into the block that
+// parsed the line, so they are only valid as long as the importer is alive.
+//
+
+struct Geo_ip_csv_row {
+    Geo_ip_num lo;
+    Geo_ip_num hi;
+    BASE::String_slice country_code;
+    BASE::String_slice country;
+    BASE::String_slice state;
+    BASE::String_slice city;
+    BASE::String_slice zip;
+    BASE::String_slice tz;
+    double latitude;
+    double longitude;
+};
+
+//
+// class Geo_ip_index_writer
+//
+// Writes the ip ranges of a dataset into a single index file, see geo_ip.h for the layout.
+//
+
+class Geo_ip_index_writer {
+
+    std::string filename;
+    std::string strings;
+    BASE::Hash_map<std::string,unsigned> string_offsets;
+    BASE::Hash_map<std::string,unsigned> record_indices;
+    BASE::Vector<Geo_ip_index_range> ranges;
+    BASE::Vector<Geo_ip_index_record> records;
+
+    unsigned append_string(const BASE::String_slice& s);
+    unsigned append_record(const Geo_ip_index_record& record);
+    unsigned append_record(const Geo_ip_entry* entry);
+
+public:
+    Geo_ip_index_writer(const std::string& filename);
+
+    void append(const Geo_ip_entry* entry);
+    void append(const Geo_ip_data* data);
+    void append(const Geo_ip_csv_row& row);
+    int write();
+};
+
+//
+// class Geo_ip_csv_block
+//
+// A line aligned part of the csv, tokenized on its own thread. A block which fails is finished as
+// well, the importer checks whether it failed.
+//
+
+class Geo_ip_csv_block : public BASE::Object<HAL::Runnable> {
+
+    const char* begin;
+    const char* end;
+    std::atomic<size_t>* progress;
+    BASE::Vector<Geo_ip_csv_row> rows;
+    std::list<std::string> unescaped;
+    int errors;
+    std::atomic<bool> finished;
+    bool failed;
+
+    void tokenize();
+    const char* next_column(const char* p, const char* eol, BASE::String_slice& column);
+    bool parse_line(const char* p, const char* eol, Geo_ip_csv_row& row);
+
+    static bool parse_ip(const BASE::String_slice& s, Geo_ip_num& ip);
+    static bool parse_degrees(const BASE::String_slice& s, double& degrees);
+
+public:
+    Geo_ip_csv_block(const char* begin, const char* end, std::atomic<size_t>* progress);
+
+    const BASE::Vector<Geo_ip_csv_row>& get_rows() const { return rows; }
+    int get_errors() const { return errors; }
+    bool is_finished() const { return finished.load(std::memory_order_acquire); }
+    bool has_failed() const { return failed; }
+    void run();
+    void fail(const std::exception& ex);
+};
+
+//
+// class Geo_ip_csv_importer
+//
+// Maps the ip csv and splits it into line aligned blocks which are parsed in parallel. Latitude and
+// longitude are expected in decimal degrees, anything else falls back to the coordinate parser.
+//
+
+class Geo_ip_csv_importer {
+
+    HAL::Mapped_file file;
+    BASE::Vector<Geo_ip_csv_block_ref> blocks;
+    std::atomic<size_t> progress;
+    int num_threads;
+
+    void report_progress(int& percent) const;
+
+public:
+    Geo_ip_csv_importer(int num_threads = 0);
+
+    int import(const std::string& filename);
+    size_t get_row_count() const;
+    template <typename F> void for_each(F functor) const;
+};
+
+template <typename F>
+void Geo_ip_csv_importer::for_each(F functor) const
+{
+    for (size_t i = 0, n = blocks.size(); i < n; i++) {
+        const BASE::Vector<Geo_ip_csv_row>& rows = blocks[i]->get_rows();
+        for (size_t j = 0, m = rows.size(); j < m; j++)
+            functor(rows[j]);
+    }
+}
+
 }}
 
 #endif
@@ -9,6 +9,7 @@
 #include "stdafx.h"
 #include "geo_ip_server.h"
 #include "geo_module.h"
+#include <climits>
 #include <iomanip>
 
 using namespace SOFTHUB::BASE;
@@ -20,20 +21,65 @@ using namespace std;
 namespace SOFTHUB {
 namespace GEOGRAPHY {
 
+static int parse_window(const string& window)
+{
+    // seconds, or minutes, hours and days with the suffix m, h or d
+    if (window.empty())
+        return 0;
+    size_t pos = 0;
+    long value = 0;
+    while (pos < window.length() && isdigit((unsigned char) window[pos]) && value < 100000000)
+        value = value * 10 + window[pos++] - '0';
+    if (pos == 0 || pos + 1 < window.length())
+        return -1;
+    char unit = pos < window.length() ? window[pos] : 's';
+    int scale = unit == 's' ? 1 : unit == 'm' ? 60 : unit == 'h' ? 3600 : unit == 'd' ? 86400 : 0;
+    if (scale == 0 || value > INT_MAX / scale)
+        return -1;
+    return (int) (value * scale);
+}
+
+static Deflate_writer::Format deflate_format(Http_content_coding coding)
+{
+    return coding == gzip_coding ? Deflate_writer::gzip_format : Deflate_writer::zlib_format;
+}
+
+//
+// class Geo_ip_reloader
+//
+
+void Geo_ip_reloader::run()
+{
+    server->rebuild_database();
+}
+
+void Geo_ip_reloader::fail(const exception& ex)
+{
+    clog << "reload failed: " << ex.what() << endl;
+}
+
 //
 // class Geo_ip_server
 //
 
 Geo_ip_server::Geo_ip_server() :
-    database(new Geo_ip_file_database()),
+    reloading(false), reload_from_any(false),
     access_log_listener(new Geo_access_log_listener(this)),
-    auth_log_listener(new Geo_auth_log_listener(this))
+    auth_log_listener(new Geo_auth_log_listener(this)),
+    encoded_contents(64), encoded_hits(0), encoded_misses(0)
 {
+    stringstream stream;
+    stream << "<head>" << endl;
+    output_header(stream);
+    stream << "</head>" << endl;
+    stream << "<body>" << endl;
+    page_head = new Http_fragment(stream.str());
 }
 
 void Geo_ip_server::configure(IConfig* config)
 {
     this->config = config;
+    database = Geo_ip_database::create(config);
     database->configure(config);
     Http_server::configure(config);
     this->set_user_agent("Sofhub-Geo-IP/1.0.0");
@@ -41,6 +87,25 @@ void Geo_ip_server::configure(IConfig* config)
     String_util::split(dstr, downloads);
     const string& bstr = config->get_parameter("geo-bots", "bot spider crawl grab");
     String_util::split(bstr, bots);
+    reload_from_any = config->get_parameter("geo-reload-from", "local") == "any";
+    int encoded_capacity = config->get_parameter("geo-compress-cache-size", 64);
+    {
+        Lock::Block lock(encoded_mutex);
+        encoded_contents.set_capacity(std::max(encoded_capacity, 0));
+    }
+    access_log_listener->configure(config);
+    auth_log_listener->configure(config);
+    const string& watch = config->get_parameter("geo-log-watch", "inotify");
+    if (watch == "inotify" && !file_watcher) {
+        file_watcher = new File_watcher();
+        if (file_watcher->is_open()) {
+            access_log_listener->get_observer()->set_watcher(file_watcher);
+            auth_log_listener->get_observer()->set_watcher(file_watcher);
+        } else {
+            log_message(WARN, "inotify not available, log files are polled");
+            file_watcher = 0;
+        }
+    }
 }
 
 bool Geo_ip_server::initialize()
@@ -51,6 +116,8 @@ bool Geo_ip_server::initialize()
     if (!Http_server::initialize())
         return false;
     service_control_event();
+    if (file_watcher)
+        Hal_module::module.instance->run(file_watcher);
     Hal_module::module.instance->run(access_log_listener);
     Hal_module::module.instance->run(auth_log_listener);
     return true;
@@ -59,6 +126,9 @@ bool Geo_ip_server::initialize()
 void Geo_ip_server::finalize()
 {
     access_log_listener->stop();
+    auth_log_listener->stop();
+    if (file_watcher)
+        file_watcher->stop();
     Http_server::finalize();
 }
 
@@ -66,6 +136,51 @@ void Geo_ip_server::service_control_event()
 {
 }
 
+Geo_ip_database_ref Geo_ip_server::get_ip_database()
+{
+    Lock::Block lock(database_mutex);
+    return database;
+}
+
+bool Geo_ip_server::reload()
+{
+    if (!Geo_ip_database::use_index(config)) {
+        clog << "reload requires an index database" << endl;
+        return false;
+    }
+    {
+        Lock::Block lock(database_mutex);
+        if (reloading)
+            return false;
+        reloading = true;
+    }
+    try {
+        Hal_module::module.instance->run(new Geo_ip_reloader(this));
+    } catch (Exception& ex) {
+        clog << "cannot start reload: " << ex.get_message() << endl;
+        Lock::Block lock(database_mutex);
+        reloading = false;
+        return false;
+    }
+    return true;
+}
+
+void Geo_ip_server::rebuild_database()
+{
+    clog << "reload started" << endl;
+    // the index is written to a temporary file and renamed, lookups keep using the previous one
+    Geo_ip_database_ref db;
+    if (Geo_module::module.instance->recover_state()) {
+        db = Geo_ip_database::create(config);
+        db->configure(config);
+    }
+    Lock::Block lock(database_mutex);
+    if (db)
+        database = db;
+    reloading = false;
+    clog << (db ? "reload complete" : "reload failed") << endl;
+}
+
 void Geo_ip_server::serve_page(const Http_service_request* sreq, Http_service_response* sres)
 {
     const Http_request_header* header = sreq->get_header();
@@ -73,7 +188,10 @@ void Geo_ip_server::serve_page(const Http_service_request* sreq, Http_service_re
     const string& method_name = header->get_method_name();
     const string& path = header->get_path();
     const Url_parameter_map& parameter_map = sreq->get_parameter_map();
-    const string& cmd = parameter_map.get("cmd");
+    string cmd = parameter_map.get("cmd");
+    // without php the form of the pages is sent here directly, the script defaults to the location
+    if (cmd.empty() && Strings::starts_with(path, "/gip/geo-ip.php"))
+        cmd = "location";
     const string& cmd_str = cmd.empty() ? "<empty>" : cmd;
     clog << "serve page " << cmd_str << " " << version << " " << method_name << " " << path << endl;
     try {
@@ -87,6 +205,10 @@ void Geo_ip_server::serve_page(const Http_service_request* sreq, Http_service_re
             serve_traffic(sreq, sres);
         } else if (cmd == "data") {
             serve_data(sreq, sres);
+        } else if (cmd == "reload") {
+            serve_reload(sreq, sres);
+        } else if (cmd == "stats") {
+            serve_stats(sreq, sres);
         } else {
             serve_error_page("invalid command", sres);
         }
@@ -111,14 +233,14 @@ void Geo_ip_server::serve_default_page(const Http_service_request* sreq, Http_se
 {
     stringstream content_stream;
     serve_default_page_content(content_stream);
-    const string& content = content_stream.str();
+    string content = content_stream.str();
     serve_content(content, "text/html", sres);
 }
 
 void Geo_ip_server::serve_echo(const Http_service_request* sreq, Http_service_response* sres)
 {
     const Url_parameter_map& parameter_map = sreq->get_parameter_map();
-    const string& message = parameter_map.get("message");
+    string message = parameter_map.get("message");
     clog << "echo request for \"" << message << "\"" << endl;
     serve_content(message, "text/html", sres);
 }
@@ -127,23 +249,17 @@ void Geo_ip_server::serve_location(const Http_service_request* sreq, Http_servic
 {
     const Url_parameter_map& parameter_map = sreq->get_parameter_map();
     const string& ip = parameter_map.get("ip");
-    Address_ref addr = Address::create_from_dns_name(ip, 0);
-    clog << "location request for " << ip << " " << (addr ? addr->to_string(false) : "-") << endl;
-    Geo_ip_entry_ref entry = addr ? database->find(addr) : unknown_ip_entry;
+    Numeric_address addr;
+    bool resolved = Numeric_address::resolve(ip, addr);
+    clog << "location request for " << ip << " " << (resolved ? addr.to_string() : "-") << endl;
+    Geo_ip_entry_ref entry = resolved ? get_ip_database()->find(addr) : nullptr;
+    if (!entry)
+        entry = unknown_ip_entry;
+    serve_common_page_head(sres);
     stringstream content_stream;
-    content_stream << "<head>" << endl;
-    output_header(content_stream);
-    content_stream << "</head>" << endl;
-    content_stream << "<body>" << endl;
-#if !(defined _DEBUG && defined PLATFORM_MAC)
-    const string& doc_root = get_document_root();
-    const string& inc = File_path::concat(doc_root, "gip/common.html");
-    const string& common = Configuration::read_file(inc);
-    content_stream << common;
-#endif
     output_location(entry, sreq, content_stream);
     content_stream << "</body>" << endl;
-    const string& content = content_stream.str();
+    string content = content_stream.str();
     serve_content(content, "text/html", sres);
     const string& location = entry->to_string();
     const string& user = sreq->get_user_ip();
@@ -152,52 +268,219 @@ void Geo_ip_server::serve_location(const Http_service_request* sreq, Http_servic
 
 void Geo_ip_server::serve_traffic(const Http_service_request* sreq, Http_service_response* sres)
 {
+    // the observers and the log locations are not meant to be shared by several serving threads
+    Lock::Block lock(mutex);
     File_observer* observer = access_log_listener->get_observer();
     observer->refresh();
     const Url_parameter_map& parameter_map = sreq->get_parameter_map();
     const string& zoom_param = parameter_map.get("zoom");
+    Http_content_coding coding = sres->get_accepted_coding();
+    if (coding != identity_coding) {
+        // the page only changes with the zoom and the file of the common part
+        stringstream key;
+        key << "traffic " << coding << " " << zoom_param;
+        Http_static_file_ref common = find_common_file();
+        if (common)
+            key << " " << common->get_etag();
+        Http_fragment_const_ref content = find_encoded(key.str());
+        if (!content) {
+            Deflate_buffer buffer(deflate_format(coding));
+            ostream stream(&buffer);
+            output_common_page_head(stream, common);
+            output_traffic(stream, zoom_param);
+            if (!buffer.finish())
+                throw Exception("failed to compress the traffic page");
+            content = new Http_fragment(buffer.get_output());
+            store_encoded(key.str(), content);
+        }
+        serve_encoded(content, "text/html", sres);
+        return;
+    }
+    serve_common_page_head(sres);
+    stringstream content_stream;
+    output_traffic(content_stream, zoom_param);
+    string content = content_stream.str();
+    serve_content(content, "text/html", sres);
+}
+
+void Geo_ip_server::output_traffic(ostream& stream, const string& zoom_param)
+{
     const Geo_coordinates& coordinates = Geo_coordinates::parse("0,0");
     const Geo_latitude& latitude = coordinates.get_latitude();
     const Geo_longitude& longitude = coordinates.get_longitude();
-    stringstream content_stream;
-    content_stream << "<head>" << endl;
-    output_header(content_stream);
-    content_stream << "</head>" << endl;
-    content_stream << "<body>" << endl;
 #if defined _DEBUG && defined PLATFORM_MAC
     const string& lat = latitude.to_string(decimal);
     const string& lon = longitude.to_string(decimal);
-    content_stream << lon << ", " << lat << " zoom: " << zoom_param << endl;
+    stream << lon << ", " << lat << " zoom: " << zoom_param << endl;
 #else
-    const string& doc_root = get_document_root();
-    const string& inc = File_path::concat(doc_root, "gip/common.html");
-    const string& common = Configuration::read_file(inc);
-    content_stream << common;
     float zoom = atof(zoom_param.c_str());
-    output_script(content_stream, zoom ? zoom : 2.25);
+    output_script(stream, zoom ? zoom : 2.25);
 #endif
-    content_stream << "</body>" << endl;
-    const string& content = content_stream.str();
-    serve_content(content, "text/html", sres);
+    stream << "</body>" << endl;
 }
 
 void Geo_ip_server::serve_data(const Http_service_request* sreq, Http_service_response* sres)
 {
+    const Url_parameter_map& parameter_map = sreq->get_parameter_map();
+    int window = parse_window(parameter_map.get("window"));
+    if (window < 0) {
+        serve_error_page("invalid window", sres);
+        return;
+    }
+    // the snapshots are not changed by the listeners
+    Geo_log_snapshot_ref access_snapshot = access_log_listener->get_snapshot();
+    Geo_log_snapshot_ref auth_snapshot = auth_log_listener->get_snapshot();
+    time_t since = window ? ::time(0) - window : 0;
+    Http_content_coding coding = sres->get_accepted_coding();
+    if (coding != identity_coding) {
+        // the data only changes with a new snapshot, or when the window moves on to the next bucket
+        stringstream key;
+        key << "data " << coding << " " << access_snapshot->get_version() << " " << auth_snapshot->get_version();
+        key << " " << (since ? access_snapshot->get_bucket(since) : 0);
+        Http_fragment_const_ref content = find_encoded(key.str());
+        if (!content) {
+            Deflate_buffer buffer(deflate_format(coding));
+            ostream stream(&buffer);
+            output_data(stream, access_snapshot, auth_snapshot, since);
+            if (!buffer.finish())
+                throw Exception("failed to compress the data");
+            content = new Http_fragment(buffer.get_output());
+            store_encoded(key.str(), content);
+        }
+        serve_encoded(content, "application/json", sres);
+        return;
+    }
     stringstream stream;
-    stream << "{ \"data\": [";
-    output_data(stream);
-    stream << "]}" << endl;
-    const string& content = stream.str();
+    output_data(stream, access_snapshot, auth_snapshot, since);
+    // the only copy of the data, the response sends this string
+    string content = stream.str();
     serve_content(content, "application/json", sres);
 }
 
-void Geo_ip_server::serve_content(const string& content, const string& content_type, Http_service_response* sres)
+bool Geo_ip_server::is_reload_permitted(const Http_service_request* sreq) const
+{
+    if (reload_from_any)
+        return true;
+    // the php script forwards the address of its user, which must be local as well
+    const string& user = sreq->get_parameter_map().get("a");
+    return sreq->get_client()->is_loopback() && (user.empty() || user == "127.0.0.1" || user == "::1");
+}
+
+void Geo_ip_server::serve_reload(const Http_service_request* sreq, Http_service_response* sres)
+{
+    const string& user = sreq->get_user_ip();
+    clog << "reload request from " << user << endl;
+    if (!is_reload_permitted(sreq)) {
+        serve_error_page("reload not permitted", sres);
+        return;
+    }
+    bool started = reload();
+    string content = started ? "reload started" : "reload not started";
+    serve_content(content, "text/plain", sres);
+}
+
+void Geo_ip_server::serve_stats(const Http_service_request* sreq, Http_service_response* sres)
+{
+    Geo_ip_database_ref database = get_ip_database();
+    const Geo_ip_cache& cache = database->get_cache();
+    stringstream stream;
+    stream << "cache-hits " << cache.get_hits() << endl;
+    stream << "cache-misses " << cache.get_misses() << endl;
+    stream << "cache-evictions " << cache.get_evictions() << endl;
+    stream << "cache-size " << cache.get_size() << endl;
+    stream << "cache-capacity " << cache.get_capacity() << endl;
+    access_log_listener->output_stats("access-log", stream);
+    auth_log_listener->output_stats("auth-log", stream);
+    stream << "access-log-dropped-lines " << access_log_listener->get_observer()->get_dropped_lines() << endl;
+    stream << "auth-log-dropped-lines " << auth_log_listener->get_observer()->get_dropped_lines() << endl;
+    Geo_log_pipeline* access_pipeline = access_log_listener->get_pipeline();
+    if (access_pipeline)
+        access_pipeline->output_stats("access-log", stream);
+    Geo_log_pipeline* auth_pipeline = auth_log_listener->get_pipeline();
+    if (auth_pipeline)
+        auth_pipeline->output_stats("auth-log", stream);
+    stream << "compress-cache-hits " << encoded_hits << endl;
+    stream << "compress-cache-misses " << encoded_misses << endl;
+    string content = stream.str();
+    serve_content(content, "text/plain", sres);
+}
+
+Http_static_file_ref Geo_ip_server::find_common_file()
+{
+#if defined _DEBUG && defined PLATFORM_MAC
+    return 0;
+#else
+    Http_static_file_ref common = find_static_file("gip/common.html");
+    if (!common)
+        clog << "failed to read from " << File_path::concat(get_document_root(), "gip/common.html") << endl;
+    return common;
+#endif
+}
+
+void Geo_ip_server::output_common_page_head(ostream& stream, const Http_static_file* common)
+{
+    stream << page_head->get_text();
+    if (common)
+        common->output(stream);
+}
+
+void Geo_ip_server::serve_common_page_head(Http_service_response* sres)
+{
+    // the head is rendered once and the common part of the pages is sent from the cache of static files
+    sres->append(page_head);
+    Http_static_file_ref common = find_common_file();
+    if (common)
+        sres->append(common);
+}
+
+void Geo_ip_server::serve_content(string& content, const string& content_type, Http_service_response* sres)
 {
+    // content of its own is compressed once it is large enough, pages of several parts are compressed by their callers
+    Http_content_coding coding = sres->get_accepted_coding();
+    if (coding != identity_coding && sres->empty() && content.length() >= get_compress_min_size()) {
+        Deflate_writer writer(deflate_format(coding));
+        if (writer.write(content.data(), content.length()) && writer.finish())
+            content.swap(writer.get_output());
+        else
+            coding = identity_coding;
+    } else {
+        coding = identity_coding;
+    }
+    // the content follows the parts already in the response, it is handed over without a copy
+    sres->adopt(content);
     stringstream stream;
-    serve_header("200 OK", content_type, content.length(), stream);
+    serve_header("200 OK", content_type, sres->get_content_length(), stream, sres->is_keep_alive(), coding);
     stream << endl;
-    stream << content;
-    sres->set_content(stream.str());
+    sres->set_header(stream.str());
+}
+
+void Geo_ip_server::serve_encoded(const Http_fragment* content, const string& content_type, Http_service_response* sres)
+{
+    sres->append(content);
+    stringstream stream;
+    serve_header("200 OK", content_type, sres->get_content_length(), stream, sres->is_keep_alive(), sres->get_accepted_coding());
+    stream << endl;
+    sres->set_header(stream.str());
+}
+
+Http_fragment_const_ref Geo_ip_server::find_encoded(const string& key)
+{
+    Lock::Block lock(encoded_mutex);
+    Http_fragment_const_ref content;
+    if (encoded_contents.get(key, content)) {
+        encoded_hits++;
+        return content;
+    }
+    encoded_misses++;
+    return 0;
+}
+
+void Geo_ip_server::store_encoded(const string& key, const Http_fragment* content)
+{
+    // earlier versions of a content are not asked for anymore and are evicted as the least recently used
+    Lock::Block lock(encoded_mutex);
+    if (encoded_contents.get_capacity() > 0)
+        encoded_contents.store(key, content);
 }
 
 void Geo_ip_server::serve_error_page(const string& msg, Http_service_response* sres)
@@ -295,25 +578,18 @@ void Geo_ip_server::output_script(ostream& stream, float zoom)
     clog << "output_script: " << clon << ", " << clat << " zoom: " << zoom << endl;
 }
 
-void Geo_ip_server::output_access_data_element(const Geo_locations::value_type& pair, ostream& stream)
+void Geo_ip_server::output_access_data_element(const Geo_log_data* data, int accesses, ostream& stream)
 {
-    const string& ip = pair.first->to_string(false);
-    const Geo_log_data* data = pair.second;
+    const string& ip = data->get_address().to_string();
     const Geo_ip_entry* entry = data->get_ip_entry();
     const Geo_coordinates& coords = entry->get_coordinates();
     float lon = coords.get_longitude().to_degrees<float>();
     float lat = coords.get_latitude().to_degrees<float>();
-    int accesses = data->get_accesses();
     const string& desc = String_util::escape(entry->get_city(), '\'');
     const string& img = data->get_img();
-    clog << "output_access_data_element: " << img << " for " << ip << endl;
-    stream << "{" << endl;
-    stream << "  \"ip\": \"" << ip << "\"," << endl;
-    stream << "  \"lon\": " << lon << "," << endl;
-    stream << "  \"lat\": " << lat << "," << endl;
-    stream << "  \"desc\": \"" << desc << " (" << accesses << ")\"," << endl;
-    stream << "  \"img\": \"" << img << "\"" << endl;
-    stream << "}";
+    // called for every location, so the lines are not flushed one by one, and without spacing
+    stream << "{\"ip\":\"" << ip << "\",\"lon\":" << lon << ",\"lat\":" << lat;
+    stream << ",\"desc\":\"" << desc << " (" << accesses << ")\",\"img\":\"" << img << "\"}";
 }
 
 void Geo_ip_server::output_location(const Geo_ip_entry* entry, const Http_service_request* sreq, ostream& stream)
@@ -350,47 +626,36 @@ void Geo_ip_server::output_location(const Geo_ip_entry* entry, const Http_servic
 #endif
 }
 
-void Geo_ip_server::output_position_data(ostream& stream, const Geo_locations& locations)
+void Geo_ip_server::output_position_data(ostream& stream, const Geo_log_snapshot* snapshot, time_t since, bool& first)
 {
-    Geo_locations::const_iterator it = locations.begin();
-    Geo_locations::const_iterator tail = locations.end();
-    if (it != tail) {
-        const Geo_locations::value_type& pair = *it++;
-        output_access_data_element(pair, stream);
-        while (it != tail) {
-            const Geo_locations::value_type& pair = *it++;
+    const Geo_locations& locations = snapshot->get_locations();
+    unsigned bucket = since ? snapshot->get_bucket(since) : 0;
+    for (Geo_locations::const_iterator it = locations.begin(); it != locations.end(); ++it) {
+        const Geo_log_data* data = it->second;
+        int accesses = data->get_accesses(bucket);
+        if (accesses == 0)
+            continue;
+        if (!first)
             stream << ",";
-            output_access_data_element(pair, stream);
-        }
+        output_access_data_element(data, accesses, stream);
+        first = false;
     }
 }
 
-void Geo_ip_server::output_access_data(ostream& stream)
-{
-    const Geo_locations& locations = access_log_listener->get_locations();
-    output_position_data(stream, locations);
-}
-
-void Geo_ip_server::output_auth_data(ostream& stream)
-{
-    const Geo_locations& locations = auth_log_listener->get_locations();
-    output_position_data(stream, locations);
-}
-
-void Geo_ip_server::output_data(ostream& stream)
+void Geo_ip_server::output_data(ostream& stream, const Geo_log_snapshot* access_snapshot, const Geo_log_snapshot* auth_snapshot, time_t since)
 {
-    output_access_data(stream);
-    const Geo_locations& access_locations = access_log_listener->get_locations();
-    const Geo_locations& auth_locations = auth_log_listener->get_locations();
-    if (!access_locations.empty() && !auth_locations.empty())
-        stream << ",";
-    output_auth_data(stream);
+    bool first = true;
+    stream << "{\"data\":[";
+    output_position_data(stream, access_snapshot, since, first);
+    output_position_data(stream, auth_snapshot, since, first);
+    stream << "]}" << endl;
 }
 
 void Geo_ip_server::output_route(const Geo_ip_entry* entry, const Http_service_request* sreq, ostream& stream)
 {
 }
 
-Geo_ip_entry_ref Geo_ip_server::unknown_ip_entry = new Geo_ip_entry();
+Geo_ip_entry_ref Geo_ip_server::unknown_ip_entry = new Geo_ip_entry(Geo_ip_range(4, 0, 0), "", "", "", "", "", "",
+    Geo_coordinates(Geo_latitude::from_degrees(0), Geo_longitude::from_degrees(0)));
 
 }}
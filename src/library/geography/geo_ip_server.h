@@ -11,6 +11,7 @@
 
 #include "geo_ip_database.h"
 #include "geo_ip_logging.h"
+#include "geo_ip_pipeline.h"
 #include <net/net.h>
 #include <util/util.h>
 
@@ -21,8 +22,26 @@ namespace SOFTHUB {
 namespace GEOGRAPHY {
 
 FORWARD_CLASS(Geo_ip_server);
+FORWARD_CLASS(Geo_ip_reloader);
 FORWARD_CLASS(Geo_log_listener);
 
+//
+// class Geo_ip_reloader
+//
+// Rebuilds the database from the csv dataset on a pool thread and hands it over to the server.
+//
+
+class Geo_ip_reloader : public BASE::Object<HAL::Runnable> {
+
+    Geo_ip_server_weak_ref server;
+
+public:
+    Geo_ip_reloader(Geo_ip_server* server) : server(server) {}
+
+    void run();
+    void fail(const std::exception& ex);
+};
+
 //
 // class Geo_ip_server
 //
@@ -33,44 +52,63 @@ class Geo_ip_server : public NET::Http_server {
 
     void output_header(std::ostream& stream);
     void output_script(std::ostream& stream, float zoom);
-    void output_access_data_element(const Geo_locations::value_type& pair, std::ostream& stream);
+    void output_access_data_element(const Geo_log_data* data, int accesses, std::ostream& stream);
     void output_location(const Geo_ip_entry* entry, const NET::Http_service_request* sreq, std::ostream& stream);
     void output_route(const Geo_ip_entry* entry, const NET::Http_service_request* sreq, std::ostream& stream);
-    void output_position_data(std::ostream& stream, const Geo_locations& locations);
-    void output_access_data(std::ostream& stream);
-    void output_auth_data(std::ostream& stream);
-    void output_data(std::ostream& stream);
+    void output_position_data(std::ostream& stream, const Geo_log_snapshot* snapshot, time_t since, bool& first);
+    void output_data(std::ostream& stream, const Geo_log_snapshot* access_snapshot, const Geo_log_snapshot* auth_snapshot, time_t since);
 
     BASE::String_vector downloads;
     BASE::String_vector bots;
 
 protected:
     HAL::Mutex mutex;
+    HAL::Mutex database_mutex;
     BASE::IConfig_ref config;
-    Geo_ip_file_database_ref database;
+    Geo_ip_database_ref database;
+    bool reloading;
+    bool reload_from_any;
     Geo_log_listener_ref access_log_listener;
     Geo_log_listener_ref auth_log_listener;
+    UTIL::File_watcher_ref file_watcher;
+    NET::Http_fragment_const_ref page_head;
+    HAL::Mutex encoded_mutex;
+    BASE::Cache<std::string,NET::Http_fragment_const_ref> encoded_contents;
+    std::atomic<unsigned long> encoded_hits;
+    std::atomic<unsigned long> encoded_misses;
 
     void service_control_event();
+    NET::Http_static_file_ref find_common_file();
+    void output_common_page_head(std::ostream& stream, const NET::Http_static_file* common);
+    void output_traffic(std::ostream& stream, const std::string& zoom_param);
+    NET::Http_fragment_const_ref find_encoded(const std::string& key);
+    void store_encoded(const std::string& key, const NET::Http_fragment* content);
     void serve_default_page_content(std::ostream& stream);
     void serve_default_page(const NET::Http_service_request* sreq, NET::Http_service_response* sres);
     void serve_echo(const NET::Http_service_request* sreq, NET::Http_service_response* sres);
     void serve_location(const NET::Http_service_request* sreq, NET::Http_service_response* sres);
     void serve_traffic(const NET::Http_service_request* sreq, NET::Http_service_response* sres);
     void serve_data(const NET::Http_service_request* sreq, NET::Http_service_response* sres);
-    void serve_content(const std::string& content, const std::string& content_type, NET::Http_service_response* sres);
+    bool is_reload_permitted(const NET::Http_service_request* sreq) const;
+    void serve_reload(const NET::Http_service_request* sreq, NET::Http_service_response* sres);
+    void serve_stats(const NET::Http_service_request* sreq, NET::Http_service_response* sres);
+    void serve_common_page_head(NET::Http_service_response* sres);
+    void serve_content(std::string& content, const std::string& content_type, NET::Http_service_response* sres);
+    void serve_encoded(const NET::Http_fragment* content, const std::string& content_type, NET::Http_service_response* sres);
     void serve_error_page(const std::string& msg, NET::Http_service_response* sres);
 
 public:
     Geo_ip_server();
 
-    Geo_ip_file_database* get_ip_database() { return database; }
+    Geo_ip_database_ref get_ip_database();
     const BASE::String_vector& get_downloads() const { return downloads; }
     const BASE::String_vector& get_bots() const { return bots; }
     BASE::IConfig* get_config() { return config; }
     void configure(BASE::IConfig* config);
     bool initialize();
     void finalize();
+    bool reload();
+    void rebuild_database();
     void serve_page(const NET::Http_service_request* sreq, NET::Http_service_response* sres);
 };
 
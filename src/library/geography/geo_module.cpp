@@ -12,6 +12,7 @@
 #include "geo_ip_server.h"
 #include "geo_ip_serialization.h"
 #include <base/base.h>
+#include <thread>
 
 #ifndef NO_GEO_PARSER
 extern void geo_altitude_test();
@@ -31,7 +32,7 @@ BASE::Module<Geo_module> Geo_module::module;
 
 Geo_module::Geo_module()
 #ifndef NO_GEO_IP
-  : ip_server(new Geo_ip_server()), server_done(false)
+  : ip_server(new Geo_ip_server()), server_done(false), reload_requested(false)
 #endif
 {
     Base_module::module.init();
@@ -39,6 +40,8 @@ Geo_module::Geo_module()
     Base_module::register_class<Geo_ip_entry>();
     Base_module::register_class<Geo_ip_mem_database>();
     Base_module::register_class<Geo_ip_file_database>();
+    Base_module::register_class<Geo_ip_index_database>();
+    Base_module::register_class<Geo_ip_mapped_database>();
 #endif
     Hal_module::module.init();
     Net_module::module.init();
@@ -70,13 +73,15 @@ Geo_module::~Geo_module()
     Base_module::unregister_class<Geo_ip_entry>();
     Base_module::unregister_class<Geo_ip_mem_database>();
     Base_module::unregister_class<Geo_ip_file_database>();
+    Base_module::unregister_class<Geo_ip_index_database>();
+    Base_module::unregister_class<Geo_ip_mapped_database>();
 #endif
     Base_module::module.dispose();
 }
 
 #ifndef NO_GEO_IP
 
-Geo_ip_database* Geo_module::get_ip_database()
+Geo_ip_database_ref Geo_module::get_ip_database()
 {
     return ip_server->get_ip_database();
 }
@@ -91,8 +96,14 @@ void Geo_module::run_service()
 {
     ip_server->start();
     // TODO: refine termination
-    while (!server_done)
-        sleep(100);
+    while (!server_done) {
+        // signal handlers only raise the flag, the reload is started from here
+        if (reload_requested) {
+            reload_requested = false;
+            ip_server->reload();
+        }
+        Thread::sleep(100);
+    }
 }
 
 void Geo_module::terminate_service()
@@ -110,25 +121,37 @@ void Geo_module::restore_state(Deserializer* deserializer)
 {
 }
 
-void Geo_module::recover_state()
+bool Geo_module::recover_state()
 {
+    bool success = false;
 #ifndef NO_GEO_IP
     Geo_ip_mem_database_ref db(new Geo_ip_mem_database());
     db->configure(config);
     const string& data_dir = db->geo_data_dir();
+    const string& index_path = db->geo_index_path();
     const string& base_dir = File_path::basepath_of(data_dir);
     const string& file_name = config->get_parameter("geo-db-csv", "geo-db.csv");
     const string& data_file = File_path::concat(base_dir, file_name);
+    Geo_ip_csv_importer importer(config->get_parameter("geo-db-import-threads", (int) std::thread::hardware_concurrency()));
     cout << "recover state from " << data_file << std::endl;
-    if (db->import(data_file)) {
+    if (importer.import(data_file)) {
         cout << "import failed" << std::endl;
+    } else if (Geo_ip_database::use_index(config)) {
+        Geo_ip_index_writer writer(index_path);
+        importer.for_each([&writer](const Geo_ip_csv_row& row) { writer.append(row); });
+        success = writer.write() == 0;
+        if (!success)
+            cout << "cannot create " << index_path << std::endl;
     } else if (File_path::ensure_dir(data_dir)) {
+        db->append(importer);
         Geo_ip_serializer serializer(data_dir);
         db->serialize(&serializer);
+        success = true;
     } else {
         cout << "cannot create " << data_dir << std::endl;
     }
 #endif
+    return success;
 }
 
 #ifdef _DEBUG
@@ -140,11 +163,227 @@ static void test_coordinates()
     assert(!cstr.empty());
 }
 
+static void test_csv_block()
+{
+    const string csv = "\"16777216\",\"1.0.0.255\",\"AU\",\"Australia\",\"Queensland\",\"South \"\"Brisbane\"\"\",\"-27.48\",\"153.02\",\"4101\",\"+10:00\"\r\n\nbad line\n";
+    std::atomic<size_t> progress(0);
+    Geo_ip_csv_block_ref block(new Geo_ip_csv_block(csv.data(), csv.data() + csv.length(), &progress));
+    block->run();
+    assert(progress == csv.length());
+    assert(block->get_errors() == 1 && block->is_finished() && !block->has_failed());
+    const Geo_ip_csv_row& row = block->get_rows()[0];
+    assert(block->get_rows().size() == 1 && row.lo == 16777216 && row.hi == 16777471);
+    assert(row.city == "South \"Brisbane\"" && row.tz == "+10:00" && row.latitude < -27);
+}
+
+static void test_ip_cache()
+{
+    Geo_ip_cache cache;
+    cache.configure(2, 1);
+    Geo_ip_entry_ref entry;
+    assert(!cache.find(1, entry));
+    cache.store(1, nullptr);
+    cache.store(2, new Geo_ip_entry());
+    cache.store(3, nullptr);
+    assert(cache.get_size() == 2 && cache.get_evictions() == 1);
+    assert(!cache.find(1, entry));
+    assert(cache.find(3, entry) && !entry);
+    assert(cache.get_hits() == 1 && cache.get_misses() == 2);
+}
+
+static void test_ip_location()
+{
+    static const char strings[] = "\0DE\0Germany\0Berlin";
+    Geo_ip_index_range range = { 1, 2, 0 };
+    Geo_ip_index_record record = { 1, 4, 12, 12, 0, 0, 52.5f, 13.4f };
+    Geo_ip_location location(&range, &record, strings, sizeof(strings));
+    assert(location.is_valid() && location.get_country() == "Germany" && location.get_zip().empty());
+    // an entry is only created on request, a location of it reads the same
+    Geo_ip_entry_ref entry = location.get_entry();
+    Geo_ip_location entry_location(entry);
+    assert(entry && entry->get_city() == "Berlin" && entry_location.get_entry() == entry);
+    assert(entry_location.is_valid() && entry_location.get_country() == "Germany" && entry_location.get_range().get_upper() == 2);
+    assert(!Geo_ip_location().is_found() && !Geo_ip_location().get_entry());
+    // offsets of a corrupt index do not reach beyond the string table
+    record.city = sizeof(strings);
+    assert(location.get_city().empty() && !location.is_valid());
+}
+
+static void test_log_tokenizer()
+{
+    const string line = "8.8.8.8 - - [18/Oct/2026:00:00:00 +0000] \"GET /a.zip HTTP/1.1\" 200 1 \"-\" \"say \\\"hi\\\"\"\r";
+    String_slices columns;
+    Geo_log_consumer::tokenize(line, columns);
+    assert(columns.size() == 9);
+    assert(columns[0] == "8.8.8.8" && columns[3] == "[18/Oct/2026:00:00:00 +0000]");
+    assert(columns[4] == "\"GET /a.zip HTTP/1.1\"" && columns[5] == "200" && columns[7] == "\"-\"");
+    assert(columns[8] == "\"say \\\"hi\\\"\"");
+    Geo_log_consumer::tokenize("Oct  8 03:35:35 pi sshd[42]: Failed password", columns);
+    assert(columns.size() == 7 && columns[1] == "8" && columns[5] == "Failed");
+}
+
+static void test_log_traffic()
+{
+    Geo_traffic traffic;
+    traffic.add(10);
+    traffic.add(10);
+    traffic.add(12);
+    traffic.add(11);
+    assert(traffic.get_total() == 4 && traffic.count_since(11) == 2 && traffic.count_since(13) == 0);
+    Geo_traffic later;
+    later.add(12);
+    later.add(14);
+    traffic.merge(later);
+    assert(traffic.get_total() == 6 && traffic.count_since(12) == 3);
+    traffic.expire(12);
+    assert(traffic.get_total() == 3 && traffic.count_since(0) == 3);
+    traffic.expire(15);
+    assert(traffic.is_empty());
+    Geo_log_consumer_ref consumer = new Geo_access_log_consumer(0);
+    String_slices columns;
+    Geo_log_consumer::tokenize("8.8.8.8 - - [18/Oct/2026:00:00:00 +0000] \"GET / HTTP/1.1\"", columns);
+    assert(consumer->log_time(columns) == 1792281600);
+    Geo_log_consumer::tokenize("8.8.8.8 - - [18/Oct/2026:00:00:00 +0200] \"GET / HTTP/1.1\"", columns);
+    assert(consumer->log_time(columns) == 1792274400);
+    Geo_log_consumer::tokenize("8.8.8.8 - - [18/Okt/2026:00:00:00 +0200] \"GET / HTTP/1.1\"", columns);
+    assert(consumer->log_time(columns) == 0);
+    // syslog lines around new year, read shortly after midnight in local time
+    Geo_auth_log_consumer_ref auth = new Geo_auth_log_consumer(0);
+    struct tm tm = {};
+    tm.tm_year = 127;
+    tm.tm_mday = 1;
+    tm.tm_min = 30;
+    tm.tm_isdst = -1;
+    time_t now = ::mktime(&tm);
+    Geo_log_consumer::tokenize("Dec 31 23:59:00 pi sshd[42]: Failed password", columns);
+    assert(auth->log_time(columns, now) == now - 31 * 60);
+    Geo_log_consumer::tokenize("Jan  1 00:10:00 pi sshd[42]: Failed password", columns);
+    assert(auth->log_time(columns, now) == now - 20 * 60);
+    Geo_log_consumer::tokenize("Jan  2 00:10:00 pi sshd[42]: Failed password", columns);
+    assert(auth->log_time(columns, now) == now + 86400 - 20 * 60);
+    tm = {};
+    tm.tm_year = 126;
+    tm.tm_mday = 3;
+    tm.tm_min = 10;
+    tm.tm_isdst = -1;
+    Geo_log_consumer::tokenize("Jan  3 00:10:00 pi sshd[42]: Failed password", columns);
+    assert(auth->log_time(columns, now) == ::mktime(&tm));
+}
+
+static void test_log_publish()
+{
+    Geo_log_listener_ref listener = new Geo_auth_log_listener(0);
+    Numeric_address a1, a2;
+    Numeric_address::parse("8.8.8.8", a1);
+    Numeric_address::parse("8.8.4.4", a2);
+    String_slices columns;
+    time_t now = ::time(0);
+    listener->store(a1, Geo_ip_location(), columns, now);
+    listener->store(a2, Geo_ip_location(), columns, now);
+    listener->publish();
+    Geo_log_snapshot_ref first = listener->get_snapshot();
+    assert(first->get_locations().size() == 2);
+    // without a change the snapshot stays, after one the unchanged location is shared
+    listener->publish();
+    assert(listener->get_snapshot() == first);
+    listener->store(a1, Geo_ip_location(), columns, now);
+    listener->publish();
+    Geo_log_snapshot_ref second = listener->get_snapshot();
+    const Geo_locations& previous = first->get_locations();
+    const Geo_locations& next = second->get_locations();
+    Geo_ip_num n1 = a1.get_ip4_number(), n2 = a2.get_ip4_number();
+    assert(second != first && next.get(n2) == previous.get(n2) && next.get(n1) != previous.get(n1));
+    assert(next.get(n1)->get_accesses() == 2 && previous.get(n1)->get_accesses() == 1);
+}
+
+static void test_log_checkpoint()
+{
+    Numeric_address addr;
+    Numeric_address::parse("8.8.8.8", addr);
+    Geo_access_log_data_ref data = new Geo_access_log_data(addr, 0);
+    data->set_link("/a.zip");
+    data->set_client("\"curl\"");
+    data->count(10, 2);
+    string strings(1, '\0');
+    Geo_log_checkpoint_location location;
+    data->save(location, strings);
+    assert(location.ip_num == addr.get_ip4_number() && location.referer == 0);
+    Geo_access_log_data_ref restored = new Geo_access_log_data(addr, 0);
+    assert(restored->restore(location, strings.data(), strings.size()));
+    assert(restored->get_link() == "/a.zip" && restored->get_client() == "\"curl\"" && restored->get_referer().empty());
+    location.client = (unsigned) strings.size();
+    assert(!restored->restore(location, strings.data(), strings.size()));
+    const Geo_traffic& traffic = data->get_traffic();
+    assert(traffic.get_size() == 1 && traffic.get_bucket(0).time == 10 && traffic.get_bucket(0).count == 2);
+    // a checkpoint of several locations is restored from the log it was written for after that log was rotated
+    const char* csv_path = "/tmp/geo-checkpoint-test.csv";
+    const char* log_path = "/tmp/geo-checkpoint-test.log";
+    const char* checkpoint_path = "/tmp/geo-checkpoint-test.ckpt";
+    const string rotated_path = string(log_path) + ".1";
+    std::ofstream csv(csv_path, std::ios::trunc);
+    csv << "\"134217728\",\"8.255.255.255\",\"US\",\"United States\",\"California\",\"Mountain View\",\"37.4\",\"-122.1\",\"94043\",\"-08:00\"\n";
+    csv.close();
+    Geo_ip_csv_importer importer;
+    assert(importer.import(csv_path) == 0);
+    Geo_ip_mem_database_ref database = new Geo_ip_mem_database();
+    database->append(importer);
+    std::ofstream log(log_path, std::ios::trunc);
+    log << "Oct 18 06:25:24 pi sshd[42]: Failed password\n";
+    log.close();
+    struct stat st;
+    assert(::stat(log_path, &st) == 0);
+    Numeric_address a1, a2, a3;
+    Numeric_address::parse("8.8.8.8", a1);
+    Numeric_address::parse("8.8.4.4", a2);
+    Numeric_address::parse("8.0.0.1", a3);
+    Geo_ip_location found;
+    assert(database->locate(a1, found) && found.get_city() == "Mountain View" && !database->locate(Numeric_address(), found));
+    String_slices columns;
+    time_t now = ::time(0);
+    Geo_log_listener_ref listener = new Geo_auth_log_listener(0);
+    listener->store(a1, Geo_ip_location(), columns, now - 3600);
+    listener->store(a1, Geo_ip_location(), columns, now - 120);
+    listener->store(a1, Geo_ip_location(), columns, now);
+    listener->store(a2, Geo_ip_location(), columns, now);
+    listener->store(a3, Geo_ip_location(), columns, now - 120);
+    listener->store(a3, Geo_ip_location(), columns, now - 120);
+    listener->set_checkpoint(checkpoint_path, 0);
+    listener->set_stream_position(st.st_size, st.st_ino);
+    listener->publish();
+    assert(::rename(log_path, rotated_path.c_str()) == 0);
+    log.open(log_path, std::ios::trunc);
+    log.close();
+    Geo_log_listener_ref restored_listener = new Geo_auth_log_listener(0);
+    restored_listener->set_checkpoint(checkpoint_path, 1);
+    assert(restored_listener->restore_checkpoint(log_path, database));
+    assert(restored_listener->get_observer()->get_position() == 0);
+    const Geo_locations& saved = listener->get_snapshot()->get_locations();
+    const Geo_locations& loaded = restored_listener->get_snapshot()->get_locations();
+    assert(saved.size() == 3 && loaded.size() == 3);
+    Geo_ip_num nums[] = { a1.get_ip4_number(), a2.get_ip4_number(), a3.get_ip4_number() };
+    for (size_t i = 0; i < 3; i++) {
+        const Geo_traffic& before = saved.get(nums[i])->get_traffic();
+        const Geo_traffic& after = loaded.get(nums[i])->get_traffic();
+        assert(after.get_size() == before.get_size() && after.get_total() == before.get_total());
+        for (size_t j = 0; j < before.get_size(); j++)
+            assert(after.get_bucket(j).time == before.get_bucket(j).time && after.get_bucket(j).count == before.get_bucket(j).count);
+    }
+    assert(loaded.get(nums[0])->get_traffic().get_size() == 3 && loaded.get(nums[2])->get_traffic().get_total() == 2);
+    // without the log of the checkpoint nothing is restored
+    ::remove(rotated_path.c_str());
+    restored_listener = new Geo_auth_log_listener(0);
+    restored_listener->set_checkpoint(checkpoint_path, 1);
+    assert(!restored_listener->restore_checkpoint(log_path, database));
+    ::remove(checkpoint_path);
+    ::remove(log_path);
+    ::remove(csv_path);
+}
+
 void Geo_module::test()
 {
 #ifdef NO_GEO_DB
     Address_ref ip = Address::create("91.64.54.207", 0);
-    const Geo_ip_database* db = Geo_module::module.instance->get_ip_database();
+    Geo_ip_database_ref db = Geo_module::module.instance->get_ip_database();
     Geo_ip_entry_ref entry = db->find(ip);
     assert(entry ? entry->get_country() == "DE" : true);
     Address_ref ip2 = Address::create("103.148.139.43", 0); // this ip is missing in dataset
@@ -156,6 +395,13 @@ void Geo_module::test()
     geo_coordinate_test();
 #endif
     test_coordinates();
+    test_csv_block();
+    test_ip_cache();
+    test_ip_location();
+    test_log_tokenizer();
+    test_log_traffic();
+    test_log_publish();
+    test_log_checkpoint();
 }
 
 #endif
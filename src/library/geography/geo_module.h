@@ -24,7 +24,8 @@ class Geo_module : public BASE::Object<> {
     BASE::IConfig_ref config;
 #ifndef NO_GEO_IP
     Geo_ip_server_ref ip_server;
-    bool server_done;
+    volatile bool server_done;
+    volatile bool reload_requested;
 #endif
 
 public:
@@ -33,14 +34,15 @@ public:
 
 #ifndef NO_GEO_IP
     Geo_ip_server* get_ip_server() { return ip_server; }
-    Geo_ip_database* get_ip_database();
+    Geo_ip_database_ref get_ip_database();
+    void request_reload() { reload_requested = true; }
 #endif
     void configure(BASE::IConfig* config);
     void run_service();
     void terminate_service();
     void save_state(BASE::Serializer* serializer);
     void restore_state(BASE::Deserializer* deserializer);
-    void recover_state();
+    bool recover_state();
 
     static BASE::Module<Geo_module> module;
 #ifdef _DEBUG
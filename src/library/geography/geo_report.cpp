@@ -72,9 +72,9 @@ void Geo_report::output_location(const Geo_ip_entry* entry, bool all_info)
     rout << endl;
 }
 
-void Geo_report::output_info(const string& ip, const Address* addr, const Geo_ip_entry* entry)
+void Geo_report::output_info(const string& ip, const Numeric_address& addr, const Geo_ip_entry* entry)
 {
-    rout << addr->to_string(false);
+    rout << addr.to_string();
     if (option_domain)
         output_ns_domain_name(ip);
     if (option_info)
@@ -191,9 +191,9 @@ Geo_location_report::Geo_location_report(ostream& rout) :
 
 void Geo_location_report::report_ip(const string& ip)
 {
-    Geo_ip_database* db = Geo_module::module.instance->get_ip_database();
-    Address_ref addr = Address::create_from_dns_name(ip, 0);
-    Geo_ip_entry_ref entry = addr ? db->find(addr) : nullptr;
+    Geo_ip_database_ref db = Geo_module::module.instance->get_ip_database();
+    Numeric_address addr;
+    Geo_ip_entry_ref entry = Numeric_address::resolve(ip, addr) ? db->find(addr) : nullptr;
     if (entry) {
         if (option_coords) {
             output_coords(entry);
@@ -216,9 +216,9 @@ Geo_route_report::Geo_route_report(ostream& rout) :
 
 void Geo_route_report::report_hop(const string& ip, Geo_coordinates* last_pos)
 {
-    Geo_ip_database* db = Geo_module::module.instance->get_ip_database();
-    Address_ref addr = Address::create_from_dns_name(ip, 0);
-    Geo_ip_entry_ref entry = addr ? db->find(addr) : nullptr;
+    Geo_ip_database_ref db = Geo_module::module.instance->get_ip_database();
+    Numeric_address addr;
+    Geo_ip_entry_ref entry = Numeric_address::resolve(ip, addr) ? db->find(addr) : nullptr;
     if (entry) {
         const Geo_coordinates& pos = entry->get_coordinates();
         if (option_eliminate_duplicates && last_pos) {
@@ -54,7 +54,7 @@ public:
     virtual void report_ip(const std::string& ip) = 0;
     virtual void output_coords(const Geo_ip_entry* entry);
     virtual void output_location(const Geo_ip_entry* entry, bool all_info = false);
-    virtual void output_info(const std::string& ip, const NET::Address* addr, const Geo_ip_entry* entry);
+    virtual void output_info(const std::string& ip, const NET::Numeric_address& addr, const Geo_ip_entry* entry);
 };
 
 //
@@ -26,13 +26,12 @@ void Persistent_cache<K,V,SID>::serialize(BASE::Serializer* serializer) const
     int n = (int) Cache_base::get_size();
     serializer->write(cap);
     serializer->write(n);
-    typename BASE::List<K>::const_iterator it = Cache_base::list.begin();
-    typename BASE::List<K>::const_iterator tail = Cache_base::list.end();
+    typename Cache_base::const_iterator it = Cache_base::begin();
+    typename Cache_base::const_iterator tail = Cache_base::end();
     while (it != tail) {
-        const K& key = *it++;
-        serializer->write(key);
-        const V& val = Cache_base::container.get(key);
-        serializer->write(val);
+        const typename Cache_base::value_type& entry = *it++;
+        serializer->write(entry.first);
+        serializer->write(entry.second);
     }
 }
 
@@ -48,8 +47,8 @@ void Persistent_cache<K,V,SID>::deserialize(BASE::Deserializer* deserializer)
         K key; V val;
         deserializer->read(key);
         deserializer->read(val);
-        Cache_base::list.append(key);
-        Cache_base::container.insert(key, val);
+        Cache_base::list.push_back(typename Cache_base::value_type(key, val));
+        Cache_base::container.insert(key, --Cache_base::list.end());
     }
 }
 
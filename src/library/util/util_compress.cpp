@@ -7,12 +7,20 @@
 //
 
 #include "util_compress.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#ifndef PLATFORM_WIN
+#include <unistd.h>
+#endif
 namespace miniz {
 #include "util_miniz.h"
 }
 
 #undef compress
 
+using namespace std;
+
 namespace SOFTHUB {
 namespace UTIL {
 
@@ -34,4 +42,326 @@ int Compression::decompress(const byte* src, long src_len, byte*& dst, long& dst
     return miniz::mz_uncompress(dst, (unsigned long*) &dst_len, src, (unsigned long) src_len);
 }
 
+//
+// class Gzip_reader
+//
+
+struct Gzip_reader::State {
+
+    enum Phase { header, body, trailer, end, failed };
+
+    Phase phase;
+    int members;
+    miniz::mz_ulong crc;
+    unsigned size;
+    size_t in_pos;
+    size_t in_len;
+    size_t pushback_pos;
+    size_t pushback_len;
+    size_t window_pos;
+    size_t window_avail;
+    miniz::tinfl_decompressor decomp;
+    byte pushback[sizeof(miniz::tinfl_bit_buf_t)];
+    miniz::mz_uint8 window[TINFL_LZ_DICT_SIZE];
+    byte input[input_size];
+
+    State() : phase(header), members(0), crc(0), size(0), in_pos(0), in_len(0), pushback_pos(0),
+        pushback_len(0), window_pos(0), window_avail(0) {}
+};
+
+Gzip_reader::Gzip_reader() : fd(-1), state(0)
+{
+}
+
+Gzip_reader::~Gzip_reader()
+{
+    close();
+}
+
+bool Gzip_reader::open(const string& filepath)
+{
+    close();
+    fd = ::open(filepath.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    state = new State();
+    return true;
+}
+
+void Gzip_reader::close()
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    delete state;
+    state = 0;
+}
+
+bool Gzip_reader::fill()
+{
+    ssize_t len;
+    do {
+        len = ::read(fd, state->input, input_size);
+    } while (len < 0 && errno == EINTR);
+    state->in_pos = 0;
+    state->in_len = len > 0 ? len : 0;
+    return len > 0;
+}
+
+bool Gzip_reader::next_byte(byte& b)
+{
+    State& s = *state;
+    if (s.pushback_pos < s.pushback_len) {
+        b = s.pushback[s.pushback_pos++];
+        return true;
+    }
+    if (s.in_pos == s.in_len && !fill())
+        return false;
+    b = s.input[s.in_pos++];
+    return true;
+}
+
+bool Gzip_reader::skip_string()
+{
+    byte b;
+    do {
+        if (!next_byte(b))
+            return false;
+    } while (b);
+    return true;
+}
+
+bool Gzip_reader::read_header(bool& end)
+{
+    byte id1, id2, method, flags, b;
+    // anything after the last member is ignored like gzip does
+    if (!next_byte(id1) || id1 != 0x1f || !next_byte(id2) || id2 != 0x8b) {
+        end = true;
+        return state->members > 0;
+    }
+    if (!next_byte(method) || method != 8 || !next_byte(flags))
+        return false;
+    // modification time, extra flags and operating system
+    for (int i = 0; i < 6; i++) {
+        if (!next_byte(b))
+            return false;
+    }
+    if (flags & 0x04) {
+        byte lo, hi;
+        if (!next_byte(lo) || !next_byte(hi))
+            return false;
+        for (int i = 0, n = lo | (hi << 8); i < n; i++) {
+            if (!next_byte(b))
+                return false;
+        }
+    }
+    if ((flags & 0x08) && !skip_string())
+        return false;
+    if ((flags & 0x10) && !skip_string())
+        return false;
+    if ((flags & 0x02) && !(next_byte(b) && next_byte(b)))
+        return false;
+    state->members++;
+    end = false;
+    return true;
+}
+
+bool Gzip_reader::read_trailer()
+{
+    unsigned value[2] = { 0, 0 };
+    for (int i = 0; i < 8; i++) {
+        byte b;
+        if (!next_byte(b))
+            return false;
+        value[i / 4] |= (unsigned) b << (i % 4 * 8);
+    }
+    return value[0] == (unsigned) state->crc && value[1] == state->size;
+}
+
+long Gzip_reader::read(char* dst, size_t len)
+{
+    if (!state)
+        return -1;
+    State& s = *state;
+    size_t n = 0;
+    while (n < len && s.phase != State::end && s.phase != State::failed) {
+        if (s.window_avail > 0) {
+            size_t k = std::min(s.window_avail, len - n);
+            const miniz::mz_uint8* data = s.window + s.window_pos;
+            ::memcpy(dst + n, data, k);
+            s.crc = miniz::mz_crc32(s.crc, data, k);
+            s.size += (unsigned) k;
+            s.window_pos = (s.window_pos + k) & (TINFL_LZ_DICT_SIZE - 1);
+            s.window_avail -= k;
+            n += k;
+        } else if (s.phase == State::header) {
+            bool end = false;
+            if (!read_header(end)) {
+                s.phase = State::failed;
+            } else if (end) {
+                s.phase = State::end;
+            } else {
+                tinfl_init(&s.decomp);
+                s.crc = 0;
+                s.size = 0;
+                s.phase = State::body;
+            }
+        } else if (s.phase == State::body) {
+            if (s.in_pos == s.in_len && !fill()) {
+                s.phase = State::failed;
+                continue;
+            }
+            size_t in_bytes = s.in_len - s.in_pos;
+            size_t out_bytes = TINFL_LZ_DICT_SIZE - s.window_pos;
+            miniz::tinfl_status status = miniz::tinfl_decompress(&s.decomp, s.input + s.in_pos, &in_bytes,
+                s.window, s.window + s.window_pos, &out_bytes, miniz::TINFL_FLAG_HAS_MORE_INPUT);
+            s.in_pos += in_bytes;
+            s.window_avail = out_bytes;
+            if (status < 0) {
+                s.phase = State::failed;
+            } else if (status == miniz::TINFL_STATUS_DONE) {
+                // the inflater reads ahead, whole bytes left in its bit buffer belong to the trailer
+                unsigned num_bits = s.decomp.m_num_bits;
+                miniz::tinfl_bit_buf_t bits = s.decomp.m_bit_buf >> (num_bits & 7);
+                s.pushback_pos = 0;
+                s.pushback_len = num_bits >> 3;
+                for (size_t i = 0; i < s.pushback_len; i++)
+                    s.pushback[i] = (byte) (bits >> (i * 8));
+                s.phase = State::trailer;
+            }
+        } else {
+            s.phase = read_trailer() ? State::header : State::failed;
+        }
+    }
+    // the data inflated before an error is returned first
+    return n == 0 && s.phase == State::failed ? -1 : (long) n;
+}
+
+//
+// class Deflate_writer
+//
+
+struct Deflate_writer::State {
+
+    Format format;
+    miniz::mz_stream stream;
+    miniz::mz_ulong crc;
+    unsigned size;
+    bool open;
+    string output;
+
+    State(Format format) : format(format), crc(MZ_CRC32_INIT), size(0), open(false) {}
+};
+
+Deflate_writer::Deflate_writer(Format format, int level) : state(new State(format))
+{
+    // gzip wraps a raw deflate stream into its own header and trailer
+    State& s = *state;
+    ::memset(&s.stream, 0, sizeof(s.stream));
+    int window_bits = format == gzip_format ? -MZ_DEFAULT_WINDOW_BITS : MZ_DEFAULT_WINDOW_BITS;
+    s.open = miniz::mz_deflateInit2(&s.stream, level, MZ_DEFLATED, window_bits, 9, miniz::MZ_DEFAULT_STRATEGY) == miniz::MZ_OK;
+    if (format == gzip_format) {
+        static const char header[] = { 0x1f, (char) 0x8b, 0x08, 0, 0, 0, 0, 0, 0, 0x03 };
+        s.output.append(header, sizeof(header));
+    }
+}
+
+Deflate_writer::~Deflate_writer()
+{
+    if (state->open)
+        miniz::mz_deflateEnd(&state->stream);
+    delete state;
+}
+
+bool Deflate_writer::write(const void* data, size_t len)
+{
+    State& s = *state;
+    if (s.format == gzip_format) {
+        s.crc = miniz::mz_crc32(s.crc, (const miniz::mz_uint8*) data, len);
+        s.size += (unsigned) len;
+    }
+    return compress_input((const byte*) data, len, false);
+}
+
+bool Deflate_writer::finish()
+{
+    State& s = *state;
+    if (!compress_input(0, 0, true))
+        return false;
+    if (s.format == gzip_format) {
+        char trailer[8];
+        for (int i = 0; i < 4; i++) {
+            trailer[i] = (char) (s.crc >> (i * 8));
+            trailer[i + 4] = (char) (s.size >> (i * 8));
+        }
+        s.output.append(trailer, sizeof(trailer));
+    }
+    return true;
+}
+
+bool Deflate_writer::compress_input(const byte* data, size_t len, bool finish)
+{
+    State& s = *state;
+    if (!s.open)
+        return false;
+    s.stream.next_in = data;
+    s.stream.avail_in = (unsigned) len;
+    int status;
+    do {
+        // the output grows by the bound of the pending input, at least by a chunk
+        size_t pos = s.output.length();
+        size_t avail = std::max((size_t) miniz::mz_deflateBound(&s.stream, s.stream.avail_in), (size_t) 4096);
+        s.output.resize(pos + avail);
+        s.stream.next_out = (miniz::mz_uint8*) &s.output[pos];
+        s.stream.avail_out = (unsigned) avail;
+        status = miniz::mz_deflate(&s.stream, finish ? miniz::MZ_FINISH : miniz::MZ_NO_FLUSH);
+        s.output.resize(pos + avail - s.stream.avail_out);
+        if (status != miniz::MZ_OK && status != miniz::MZ_STREAM_END && status != miniz::MZ_BUF_ERROR) {
+            s.open = false;
+            miniz::mz_deflateEnd(&s.stream);
+            return false;
+        }
+    } while (s.stream.avail_in > 0 || (finish && status != miniz::MZ_STREAM_END));
+    return true;
+}
+
+string& Deflate_writer::get_output()
+{
+    return state->output;
+}
+
+//
+// class Deflate_buffer
+//
+
+Deflate_buffer::Deflate_buffer(Deflate_writer::Format format, int level) : writer(format, level), failed(false)
+{
+    setp(chunk, chunk + chunk_size);
+}
+
+Deflate_buffer::int_type Deflate_buffer::overflow(int_type c)
+{
+    if (sync() != 0)
+        return traits_type::eof();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+int Deflate_buffer::sync()
+{
+    size_t len = pptr() - pbase();
+    if (len > 0 && !writer.write(pbase(), len))
+        failed = true;
+    setp(chunk, chunk + chunk_size);
+    return failed ? -1 : 0;
+}
+
+bool Deflate_buffer::finish()
+{
+    return sync() == 0 && writer.finish();
+}
+
 }}
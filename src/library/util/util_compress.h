@@ -10,6 +10,8 @@
 #define LIB_UTIL_COMPRESS_H
 
 #include <base/base.h>
+#include <string>
+#include <streambuf>
 
 namespace SOFTHUB {
 namespace UTIL {
@@ -25,6 +27,98 @@ public:
     static int decompress(const byte* src, long src_len, byte*& dst, long& dst_len);
 };
 
+//
+// class Gzip_reader
+//
+// Streams the content of a gzip file through a fixed size input buffer and the 32k window of the
+// inflater, the uncompressed data is never held as a whole. Files of several members, as written by
+// concatenating gzip files, are read as one stream. The crc and size of every member are checked.
+//
+
+class Gzip_reader {
+
+    struct State;
+
+    static const size_t input_size = 1 << 16;
+
+    int fd;
+    State* state;
+
+    bool fill();
+    bool next_byte(byte& b);
+    bool skip_string();
+    bool read_header(bool& end);
+    bool read_trailer();
+
+    Gzip_reader(const Gzip_reader&);
+    Gzip_reader& operator=(const Gzip_reader&);
+
+public:
+    Gzip_reader();
+    ~Gzip_reader();
+
+    bool open(const std::string& filepath);
+    long read(char* dst, size_t len);
+    void close();
+};
+
+//
+// class Deflate_writer
+//
+// Deflates the data written in pieces and appends the result to its output, either as a gzip member
+// or as a zlib stream, the formats of the http content codings gzip and deflate.
+//
+
+class Deflate_writer {
+
+    struct State;
+
+    State* state;
+
+    bool compress_input(const byte* data, size_t len, bool finish);
+
+    Deflate_writer(const Deflate_writer&);
+    Deflate_writer& operator=(const Deflate_writer&);
+
+public:
+    enum Format { gzip_format, zlib_format };
+
+    static const int default_level = 6;
+
+    Deflate_writer(Format format, int level = default_level);
+    ~Deflate_writer();
+
+    bool write(const void* data, size_t len);
+    bool finish();
+    std::string& get_output();
+};
+
+//
+// class Deflate_buffer
+//
+// Stream buffer which deflates what is written to its stream in chunks, so the uncompressed data is
+// never held as a whole.
+//
+
+class Deflate_buffer : public std::streambuf {
+
+    static const size_t chunk_size = 16384;
+
+    Deflate_writer writer;
+    char chunk[chunk_size];
+    bool failed;
+
+protected:
+    int_type overflow(int_type c);
+    int sync();
+
+public:
+    Deflate_buffer(Deflate_writer::Format format, int level = Deflate_writer::default_level);
+
+    bool finish();
+    std::string& get_output() { return writer.get_output(); }
+};
+
 }}
 
 #endif
@@ -7,8 +7,20 @@
 //
 
 #include "util_file.h"
+#include "util_compress.h"
 #include "util_string.h"
 #include <hal/hal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifndef PLATFORM_WIN
+#include <unistd.h>
+#endif
+#if FEATURE_UTIL_INOTIFY
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
 
 using namespace SOFTHUB::BASE;
 using namespace SOFTHUB::HAL;
@@ -21,21 +33,32 @@ namespace UTIL {
 // class File_observer
 //
 
+const size_t File_observer::max_buffer_size;
+
 File_observer::File_observer(IFile_consumer* consumer) :
-    stream_pos(0), stream_ino(0), consumer(consumer)
+    stream_pos(0), stream_ino(0), consumer(consumer), watcher(0), skipping(false), dropped_lines(0)
 {
 }
 
 bool File_observer::tail(const string& filepath, bool listen)
 {
     bool success = false;
-    ifstream stream;
-    stream.open(filepath, fstream::in);
-    if (stream.good()) {
-//      stream.seekg(0, ios::end);
-        success = process_log_file(stream);
-        stream.close();
-        if (success && listen)
+    int fd = ::open(filepath.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        // a position of another file, like the one the log was rotated from, starts it from the beginning
+        struct stat st;
+        if (::fstat(fd, &st) == 0) {
+            if ((stream_ino != 0 && st.st_ino != stream_ino) || st.st_size < stream_pos) {
+                stream_pos = 0;
+                skipping = false;
+            }
+            stream_ino = st.st_ino;
+        }
+        success = process_lines(fd);
+        ::close(fd);
+        this->filepath = filepath;
+        // with a watcher the tail continues on the watcher thread
+        if (success && listen && !(watcher && watcher->add(this)))
             success = process_tail(filepath);
 #if _DEBUG
     } else {
@@ -51,17 +74,116 @@ void File_observer::refresh()
     condition.signal();
 }
 
-bool File_observer::process_log_file(istream& stream)
+bool File_observer::process_lines(int fd)
 {
+    if (::lseek(fd, stream_pos, SEEK_SET) < 0)
+        return false;
+    if (buffer.size() < chunk_size)
+        buffer.resize(chunk_size);
     bool success = true;
-    string line;
-    while (success && !stream.eof() && getline(stream, line)) {
-        success = consumer->consumer_process(line);
-        stream_pos = stream.tellg();
+    size_t filled = 0;
+    while (success) {
+        if (filled == buffer.size()) {
+            size_t dropped = make_room(filled);
+            stream_pos += dropped;
+            filled -= dropped;
+        }
+        ssize_t len = ::read(fd, &buffer[filled], buffer.size() - filled);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            break;
+        filled += len;
+        size_t consumed = skipping ? skip_line(filled) : 0;
+        if (!skipping)
+            consumed += process_chunk(buffer.data() + consumed, filled - consumed, success);
+        // the position is only advanced past complete lines
+        stream_pos += consumed;
+        filled -= consumed;
+        if (filled > 0 && consumed > 0)
+            ::memmove(&buffer[0], &buffer[consumed], filled);
     }
+    // the lines read so far are complete for the consumer
+    consumer->consumer_flush();
+    return success;
+}
+
+bool File_observer::process(const char* data, size_t len)
+{
+    bool success = true;
+    process_chunk(data, len, success);
     return success;
 }
 
+bool File_observer::process_compressed(const string& filepath)
+{
+    Gzip_reader reader;
+    if (!reader.open(filepath))
+        return false;
+    if (buffer.size() < chunk_size)
+        buffer.resize(chunk_size);
+    bool success = true;
+    size_t filled = 0;
+    skipping = false;
+    while (success) {
+        if (filled == buffer.size())
+            filled -= make_room(filled);
+        long len = reader.read(&buffer[filled], buffer.size() - filled);
+        if (len <= 0) {
+            success = len == 0;
+            break;
+        }
+        filled += len;
+        size_t consumed = skipping ? skip_line(filled) : 0;
+        if (!skipping)
+            consumed += process_chunk(buffer.data() + consumed, filled - consumed, success);
+        filled -= consumed;
+        if (filled > 0 && consumed > 0)
+            ::memmove(&buffer[0], &buffer[consumed], filled);
+    }
+    // a compressed log is no longer written, so a last line without newline is complete
+    if (success && filled > 0 && !skipping)
+        success = consumer->consumer_process(String_slice(buffer.data(), filled));
+    skipping = false;
+    consumer->consumer_flush();
+    return success;
+}
+
+size_t File_observer::make_room(size_t filled)
+{
+    // a line longer than the buffer lets it grow up to the limit, beyond it the line is dropped
+    if (buffer.size() < max_buffer_size) {
+        buffer.resize(std::min(buffer.size() * 2, max_buffer_size));
+        return 0;
+    }
+    skipping = true;
+    dropped_lines++;
+    return filled;
+}
+
+size_t File_observer::skip_line(size_t filled)
+{
+    const char* eol = (const char*) ::memchr(buffer.data(), '\n', filled);
+    if (!eol)
+        return filled;
+    skipping = false;
+    return eol - buffer.data() + 1;
+}
+
+size_t File_observer::process_chunk(const char* data, size_t len, bool& success)
+{
+    const char* p = data;
+    const char* end = data + len;
+    while (success && p < end) {
+        const char* q = (const char*) ::memchr(p, '\n', end - p);
+        if (!q)
+            break;
+        success = consumer->consumer_process(String_slice(p, q - p));
+        p = q + 1;
+    }
+    return p - data;
+}
+
 bool File_observer::process_tail(const string& filepath)
 {
     bool done = false;
@@ -73,34 +195,202 @@ bool File_observer::process_tail(const string& filepath)
     return true;
 }
 
+void File_observer::changed()
+{
+    Lock::Block lock(mutex);
+    process_tail_lines(filepath);
+}
+
 bool File_observer::process_tail_lines(const string& filepath)
 {
-    // check if this could be done more elegantly using inotify
-    ifstream stream;
-    stream.open(filepath, fstream::in);
-    if (!stream.good())
+    int fd = ::open(filepath.c_str(), O_RDONLY);
+    if (fd < 0)
         return false;
     bool log_rot = false;
     struct stat st;
-    int result = ::stat(filepath.c_str(), &st);
+    int result = ::fstat(fd, &st);
     if (result == 0) {
-        log_rot = stream_ino != 0 && st.st_ino != stream_ino;
+        // a truncated file is treated like a rotated one
+        log_rot = (stream_ino != 0 && st.st_ino != stream_ino) || st.st_size < stream_pos;
         stream_ino = st.st_ino;
     }
     if (log_rot) {
         consumer->consumer_reset();
         stream_pos = 0;
-    } else {
-        string line;
-        stream.seekg(stream_pos, ios::beg);
-        while (!stream.eof() && getline(stream, line)) {
-            consumer->consumer_process(line);
-            stream_pos = stream.tellg();
-        }
     }
+    // a line without newline is still being written, it is read again once it is complete
+    process_lines(fd);
     // TODO: interrupt
-    stream.close();
+    ::close(fd);
     return false;
 }
 
+//
+// class File_watcher
+//
+
+#if FEATURE_UTIL_INOTIFY
+
+File_watcher::File_watcher() : notify_fd(::inotify_init1(IN_CLOEXEC))
+{
+    if (::pipe(stop_fds) < 0) {
+        stop_fds[0] = stop_fds[1] = -1;
+        if (notify_fd >= 0)
+            ::close(notify_fd);
+        notify_fd = -1;
+    }
+}
+
+File_watcher::~File_watcher()
+{
+    if (notify_fd >= 0)
+        ::close(notify_fd);
+    if (stop_fds[0] >= 0) {
+        ::close(stop_fds[0]);
+        ::close(stop_fds[1]);
+    }
+}
+
+bool File_watcher::add(File_observer* observer)
+{
+    Lock::Block lock(mutex);
+    if (notify_fd < 0 || !watch_file(observer))
+        return false;
+    const string& filepath = observer->get_filepath();
+    size_t pos = filepath.rfind('/');
+    const string& dir = pos == string::npos ? "." : (pos == 0 ? "/" : filepath.substr(0, pos));
+    int wd = ::inotify_add_watch(notify_fd, dir.c_str(), IN_CREATE | IN_MOVED_TO);
+    if (wd >= 0)
+        directories[wd].append(observer);
+    return true;
+}
+
+bool File_watcher::watch_file(File_observer* observer)
+{
+    const string& filepath = observer->get_filepath();
+    int wd = ::inotify_add_watch(notify_fd, filepath.c_str(), IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF);
+    if (wd < 0)
+        return false;
+    files[wd] = observer;
+    return true;
+}
+
+void File_watcher::run()
+{
+    // inotify events are aligned for struct inotify_event
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2];
+    fds[0].fd = notify_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = stop_fds[0];
+    fds[1].events = POLLIN;
+    while (notify_fd >= 0) {
+        fds[0].revents = fds[1].revents = 0;
+        if (::poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (fds[1].revents) {
+            char c;
+            if (::read(stop_fds[0], &c, 1) < 0)
+                log_message(ERR, "failed to read file watcher stop request");
+            break;
+        }
+        ssize_t len = ::read(notify_fd, buf, sizeof(buf));
+        if (len <= 0) {
+            if (len < 0 && (errno == EINTR || errno == EAGAIN))
+                continue;
+            break;
+        }
+        for (char* p = buf; p < buf + len; ) {
+            const struct inotify_event* event = (const struct inotify_event*) p;
+            process_event(event->wd, event->mask, event->len ? event->name : 0);
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+void File_watcher::process_event(int wd, unsigned mask, const char* name)
+{
+    File_observer_ref observer;
+    bool rotated = false;
+    {
+        Lock::Block lock(mutex);
+        File_watches::iterator it = files.find(wd);
+        if (it != files.end()) {
+            observer = it->second;
+            if (mask & (IN_MOVE_SELF | IN_DELETE_SELF)) {
+                ::inotify_rm_watch(notify_fd, wd);
+                files.erase(it);
+            } else if (mask & IN_IGNORED) {
+                files.erase(it);
+                observer = 0;
+            }
+        } else if (name && (mask & (IN_CREATE | IN_MOVED_TO))) {
+            Directory_watches::iterator dit = directories.find(wd);
+            if (dit == directories.end())
+                return;
+            Vector<File_observer_ref>& observers = dit->second;
+            for (size_t i = 0; i < observers.size() && !observer; i++) {
+                const string& filepath = observers[i]->get_filepath();
+                size_t pos = filepath.rfind('/');
+                if (filepath.compare(pos == string::npos ? 0 : pos + 1, string::npos, name) == 0 && watch_file(observers[i])) {
+                    observer = observers[i];
+                    rotated = true;
+                }
+            }
+        }
+    }
+    // the observer recognizes a new file of the same name by its inode and reads it from the start
+    if (observer && (rotated || (mask & IN_MODIFY)))
+        observer->changed();
+}
+
+void File_watcher::stop()
+{
+    if (stop_fds[1] >= 0 && ::write(stop_fds[1], "x", 1) < 0)
+        log_message(ERR, "failed to stop file watcher");
+}
+
+#else
+
+File_watcher::File_watcher() : notify_fd(-1)
+{
+    stop_fds[0] = stop_fds[1] = -1;
+}
+
+File_watcher::~File_watcher()
+{
+}
+
+bool File_watcher::add(File_observer* observer)
+{
+    return false;
+}
+
+bool File_watcher::watch_file(File_observer* observer)
+{
+    return false;
+}
+
+void File_watcher::run()
+{
+}
+
+void File_watcher::process_event(int wd, unsigned mask, const char* name)
+{
+}
+
+void File_watcher::stop()
+{
+}
+
+#endif
+
+void File_watcher::fail(const exception& ex)
+{
+    log_message(ERR, ex.what());
+}
+
 }}
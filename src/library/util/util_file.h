@@ -13,45 +13,113 @@
 #include <hal/hal.h>
 #include <fstream>
 
+#ifndef FEATURE_UTIL_INOTIFY
+#ifdef PLATFORM_LINUX
+#define FEATURE_UTIL_INOTIFY 1
+#else
+#define FEATURE_UTIL_INOTIFY 0
+#endif
+#endif
+
 namespace SOFTHUB {
 namespace UTIL {
 
 FORWARD_CLASS(File_observer);
+FORWARD_CLASS(File_watcher);
 FORWARD_CLASS(IFile_consumer);
 
 //
 // class File_observer
 //
+// Without a watcher, a listening tail polls the file every 10 seconds or when refreshed. The file is
+// read in large chunks and split into lines in place, an incomplete last line is kept in the buffer
+// until the rest of it has been written. A gzip compressed log, like a rotated one, is inflated into
+// the same buffer. A line longer than max_buffer_size is dropped up to the next newline and counted.
+//
 
 class File_observer : public BASE::Object<> {
 
+    friend class File_watcher;
+
+    static const size_t chunk_size = 1 << 20;
+    static const size_t max_buffer_size = 4 << 20;
+
     HAL::Mutex mutex;
     HAL::Condition condition;
-    std::ifstream::pos_type stream_pos;
+    off_t stream_pos;
     ularge stream_ino;
     IFile_consumer_ref consumer;
-
-    bool process_log_line(const std::string& line);
-    bool process_log_file(std::istream& stream);
+    File_watcher_weak_ref watcher;
+    std::string filepath;
+    std::string buffer;
+    bool skipping;
+    std::atomic<unsigned long> dropped_lines;
+
+    size_t make_room(size_t filled);
+    size_t skip_line(size_t filled);
+    bool process_lines(int fd);
+    size_t process_chunk(const char* data, size_t len, bool& success);
     bool process_tail(const std::string& filepath);
     bool process_tail_lines(const std::string& filepath);
+    void changed();
 
 public:
     File_observer(IFile_consumer* consumer);
 
+    void set_watcher(File_watcher* watcher) { this->watcher = watcher; }
+    const std::string& get_filepath() const { return filepath; }
+    void set_position(off_t pos, ularge ino) { stream_pos = pos; stream_ino = ino; skipping = false; }
+    off_t get_position() const { return stream_pos; }
+    ularge get_inode() const { return stream_ino; }
+    unsigned long get_dropped_lines() const { return dropped_lines; }
+    bool process(const char* data, size_t len);
+    bool process_compressed(const std::string& filepath);
     bool tail(const std::string& filepath, bool listen = false);
     void refresh();
 };
 
 //
-// class File_observer
+// class File_watcher
+//
+// Reports appends and rotation of the files of any number of observers on one thread. Rotation is
+// detected by watching the parent directory for a new file of the same name.
+//
+
+class File_watcher : public BASE::Object<HAL::Runnable> {
+
+    typedef BASE::Hash_map<int,File_observer_ref> File_watches;
+    typedef BASE::Hash_map<int,BASE::Vector<File_observer_ref>> Directory_watches;
+
+    HAL::Mutex mutex;
+    int notify_fd;
+    int stop_fds[2];
+    File_watches files;
+    Directory_watches directories;
+
+    bool watch_file(File_observer* observer);
+    void process_event(int wd, unsigned mask, const char* name);
+
+public:
+    File_watcher();
+    ~File_watcher();
+
+    bool is_open() const { return notify_fd >= 0; }
+    bool add(File_observer* observer);
+    void run();
+    void fail(const std::exception& ex);
+    void stop();
+};
+
+//
+// class IFile_consumer
 //
 
 class IFile_consumer : public BASE::Interface {
 
 public:
-    virtual bool consumer_process(const std::string& line) = 0;
+    virtual bool consumer_process(const BASE::String_slice& line) = 0;
     virtual void consumer_reset() = 0;
+    virtual void consumer_flush() = 0;
 };
 
 }}
@@ -190,10 +190,13 @@ FORWARD_CLASS(Log_consumer);
 class Log_consumer : public BASE::Object<IFile_consumer> {
 
 public:
+    String_vector lines;
+
     Log_consumer() {}
 
-    bool consumer_process(const std::string& line) { return true; }
-    void consumer_reset() {}
+    bool consumer_process(const String_slice& line) { lines.append(line.to_string()); return true; }
+    void consumer_reset() { lines.clear(); }
+    void consumer_flush() {}
 };
 
 static void test_log_reader()
@@ -208,6 +211,99 @@ static void test_log_reader()
     observer->tail(filepath, false);
 }
 
+static void test_log_partial_lines()
+{
+    const char* filepath = "/tmp/util-file-test.log";
+    std::ofstream stream(filepath, std::ios::trunc);
+    stream << "a b\nc d\ne";
+    stream.flush();
+    Log_consumer_ref consumer(new Log_consumer());
+    File_observer_ref observer(new File_observer(consumer));
+    assert(observer->tail(filepath, false));
+    assert(consumer->lines.size() == 2 && consumer->lines[1] == "c d");
+    // the incomplete line is read once it is complete
+    stream << " f\n";
+    stream.close();
+    assert(observer->tail(filepath, false));
+    assert(consumer->lines.size() == 3 && consumer->lines[2] == "e f");
+    ::remove(filepath);
+}
+
+static void test_log_long_lines()
+{
+    const char* filepath = "/tmp/util-file-test.log";
+    std::ofstream stream(filepath, std::ios::trunc);
+    stream << "a b\n" << std::string(5 << 20, 'x') << "\nc d\n";
+    stream.close();
+    Log_consumer_ref consumer(new Log_consumer());
+    File_observer_ref observer(new File_observer(consumer));
+    // the line beyond the limit of the buffer is dropped, the following lines are read
+    assert(observer->tail(filepath, false));
+    assert(consumer->lines.size() == 2 && consumer->lines[1] == "c d" && observer->get_dropped_lines() == 1);
+    ::remove(filepath);
+}
+
+static void test_log_compressed()
+{
+    // two gzip members, the last line lacks the newline
+    static const byte data[] = {
+        0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x4b, 0x54, 0x48, 0xe2, 0x4a, 0x56, 0x48,
+        0xe1, 0x02, 0x00, 0x90, 0xa9, 0xc8, 0x49, 0x08, 0x00, 0x00, 0x00, 0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x02, 0x03, 0x4b, 0x55, 0x48, 0x03, 0x00, 0x16, 0x30, 0x08, 0x80, 0x03, 0x00, 0x00, 0x00
+    };
+    const char* filepath = "/tmp/util-file-test.log.gz";
+    std::ofstream stream(filepath, std::ios::trunc | std::ios::binary);
+    stream.write((const char*) data, sizeof(data));
+    stream.close();
+    Log_consumer_ref consumer(new Log_consumer());
+    File_observer_ref observer(new File_observer(consumer));
+    assert(observer->process_compressed(filepath));
+    assert(consumer->lines.size() == 3 && consumer->lines[1] == "c d" && consumer->lines[2] == "e f");
+    // a corrupted crc fails the member
+    std::fstream corrupt(filepath, std::ios::in | std::ios::out | std::ios::binary);
+    corrupt.seekp(20);
+    corrupt.put((char) 0);
+    corrupt.close();
+    consumer->lines.clear();
+    assert(!observer->process_compressed(filepath) && consumer->lines.size() == 2);
+    ::remove(filepath);
+}
+
+static void test_deflate()
+{
+    std::string text;
+    for (int i = 0; i < 2000; i++)
+        text += "{\"ip\":\"10.0.0." + std::to_string(i % 256) + "\"},";
+    // a gzip member is read back by the reader of rotated logs
+    const char* filepath = "/tmp/util-deflate-test.gz";
+    Deflate_buffer buffer(Deflate_writer::gzip_format);
+    std::ostream stream(&buffer);
+    stream << text;
+    assert(buffer.finish() && buffer.get_output().length() < text.length() / 4);
+    std::ofstream file(filepath, std::ios::trunc | std::ios::binary);
+    file << buffer.get_output();
+    file.close();
+    Gzip_reader reader;
+    assert(reader.open(filepath));
+    std::string inflated;
+    char buf[4096];
+    long len;
+    while ((len = reader.read(buf, sizeof(buf))) > 0)
+        inflated.append(buf, len);
+    assert(len == 0 && inflated == text);
+    reader.close();
+    ::remove(filepath);
+    // a zlib stream is what mz_uncompress expects
+    Deflate_writer writer(Deflate_writer::zlib_format);
+    assert(writer.write(text.data(), 1000) && writer.write(text.data() + 1000, text.length() - 1000) && writer.finish());
+    const std::string& output = writer.get_output();
+    byte* dst = new byte[text.length()];
+    long dst_len = (long) text.length();
+    int res = Compression::decompress((const byte*) output.data(), (long) output.length(), dst, dst_len);
+    assert(res == 0 && dst_len == (long) text.length() && memcmp(dst, text.data(), dst_len) == 0);
+    delete[] dst;
+}
+
 static void test_string_iterator()
 {
     const std::string& str = "abüc";
@@ -222,6 +318,10 @@ void Util_module::test()
 {
     test_string_iterator();
     test_log_reader();
+    test_log_partial_lines();
+    test_log_long_lines();
+    test_log_compressed();
+    test_deflate();
     test_string_utils();
     test_tmp_base64();
     test_base64();